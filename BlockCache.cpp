@@ -0,0 +1,147 @@
+//
+// Basic block translator for the CPU: decodes straight-line runs of ROM code once and
+// executes them from pre-decoded MicroOp arrays.
+//
+
+#include "BlockCache.h"
+#include "CPU.h"
+#include "Bus.h"
+#include "OpcodeTable.h"
+
+using std::uint8_t;
+using std::uint16_t;
+
+BasicBlock* BlockCache::insert(std::unique_ptr<BasicBlock> block) {
+    auto& slot = blocks[block->start];
+    if (!slot) count++;
+    else retired.push_back(std::move(slot));
+    slot = std::move(block);
+    return slot.get();
+}
+
+bool BlockCache::invalidate(uint16_t lo, uint16_t hi) {
+    if (count == 0 || lo >= CACHED_END) return false;
+    if (hi >= CACHED_END) hi = CACHED_END - 1;
+    // a block covering lo can start at most MAX_BLOCK_BYTES - 1 bytes earlier
+    int first = lo >= MAX_BLOCK_BYTES ? lo - MAX_BLOCK_BYTES + 1 : 0;
+    bool dropped = false;
+    for (int pc = first; pc <= hi; pc++) {
+        auto& slot = blocks[pc];
+        if (slot && slot->end > lo) {
+            // NOTE: the block may be the one currently executing, so only retire it here
+            retired.push_back(std::move(slot));
+            count--;
+            dropped = true;
+        }
+    }
+    return dropped;
+}
+
+void BlockCache::clear() {
+    invalidate(0, CACHED_END - 1);
+}
+
+namespace {
+
+// Opcodes after which execution can't simply fall through to the next byte, or after which
+// the Bus has to look at interrupts again
+bool endsBlock(uint8_t op) {
+    switch (op) {
+        case 0x10: // STOP
+        case 0x76: // HALT
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+        case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: case 0xE9: // JP
+        case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: // CALL
+        case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8: case 0xD9: // RET/RETI
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // RST
+        case 0xF3: case 0xFB: // DI/EI
+        case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB: case 0xEC: case 0xED: case 0xF4:
+        case 0xFC: case 0xFD: // no mapping
+            return true;
+        default:
+            return false;
+    }
+}
+
+} // namespace
+
+/**
+ * Decode from pc until a block terminator, the size limits, or the end of the cached area.
+ * NOTE: this is the only place the block core fetches code through the Bus.
+ */
+BasicBlock* CPU::decodeBlock(uint16_t pc) {
+    std::unique_ptr<BasicBlock> block(new BasicBlock());
+    block->start = pc;
+    uint32_t addr = pc;
+    while (block->ops.size() < BlockCache::MAX_BLOCK_OPS) {
+        uint8_t op = bus->READ(addr);
+        const INSTRUCTION* ins = &OpcodeTable::lookup[op];
+        MicroOp uop{OpcodeTable::decoded[op], 0, ins->length, ins->cycles, op};
+        if (op == 0xCB) {
+            uint8_t cb = bus->READ(addr + 1);
+            ins = &OpcodeTable::lookupCB[cb];
+            uop = MicroOp{OpcodeTable::decodedCB[cb], 0, ins->length, ins->cycles, (uint16_t)(0x100u | cb)};
+        } else if (ins->length == 2) {
+            uop.operand = bus->READ(addr + 1);
+        } else if (ins->length == 3) {
+            uop.operand = bus->READ(addr + 1) | (uint16_t)(bus->READ(addr + 2) << 8u);
+        }
+        // never decode past the cached area or the invalidation window
+        if (addr + uop.length > BlockCache::CACHED_END || addr + uop.length - pc > BlockCache::MAX_BLOCK_BYTES) break;
+        block->ops.push_back(uop);
+        block->cycles += uop.cycles;
+        addr += uop.length;
+        if (endsBlock(op)) break;
+    }
+    // an instruction straddling the end of ROM is left to the interpreter
+    if (block->ops.empty()) return nullptr;
+    block->end = (uint16_t) addr;
+    return blockCache.insert(std::move(block));
+}
+
+/**
+ * Block core: look up (or decode) the block at PC and run its MicroOps back to back.
+ * Code outside the cached area (WRAM/HRAM) is single-stepped by the table core.
+ */
+int CPU::runBlocks(int budget) {
+    blockCache.collect();
+    int spent = 0;
+    runBreak = false;
+    while (spent < budget && !runBreak) {
+        BasicBlock* block = regs.pc < BlockCache::CACHED_END ? blockCache.find(regs.pc) : nullptr;
+        if (!block && regs.pc < BlockCache::CACHED_END) block = decodeBlock(regs.pc);
+        if (!block) {
+            runCycles = spent;
+            spent += stepTable();
+            retired++;
+            continue;
+        }
+        for (const MicroOp& op : block->ops) {
+            regs.pc += op.length;
+            runCycles = spent;
+            retired++;
+            spent += op.exec(*this, op.operand);
+            if (spent >= budget || runBreak) return spent;
+        }
+    }
+    return spent;
+}
+
+void CPU::invalidateBlocks(uint16_t lo, uint16_t hi) {
+    // make a running block core stop right after the instruction that did the write
+    if (blockCache.invalidate(lo, hi)) runBreak = true;
+}
+
+// Pre-decoded handlers: same bodies as OP_/CB_, but operands come from the MicroOp.
+// PC has already been advanced past the whole instruction by runBlocks.
+#define ReadNn() (operand)
+#define ReadN() ((uint8_t) operand)
+#define ReadI() ((int8_t) operand)
+#define OP(code, length, cycles, name, expr) CPU::OPCODE CPU::DOP_##code(uint16_t operand) { (void) operand; return expr; }
+#define CB_OP(code, length, cycles, name, expr) CPU::OPCODE CPU::DCB_##code(uint16_t operand) { (void) operand; return expr; }
+#include "Opcodes.inc"
+#undef OP
+#undef CB_OP
+#undef ReadNn
+#undef ReadN
+#undef ReadI
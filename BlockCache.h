@@ -0,0 +1,68 @@
+//
+// Cache of pre-decoded basic blocks for the CPU (see CPU::runBlocks).
+//
+
+#ifndef NESEMULATOR_BLOCKCACHE_H
+#define NESEMULATOR_BLOCKCACHE_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class CPU;
+
+/**
+ * One decoded instruction. The operand bytes are fetched once at decode time,
+ * so executing it never goes back through the Bus for the opcode stream.
+ */
+struct MicroOp {
+    int (*exec)(CPU&, uint16_t operand);
+    uint16_t operand;  // n, nn or i (sign extended by the handler), 0 if unused
+    uint8_t length;    // bytes the instruction occupies; PC is advanced by this before exec
+    uint8_t cycles;    // nominal M-cycles, see OpcodeTable
+    uint16_t code;     // opcode, 0x1xx for 0xCB prefixed ones (used by the JIT)
+};
+
+/**
+ * Straight-line run of instructions starting at `start`, ending after the first
+ * control-flow/interrupt related instruction (or when the size limits are hit).
+ */
+struct BasicBlock {
+    uint16_t start = 0;
+    uint16_t end = 0;   // one past the last byte decoded
+    uint16_t cycles = 0; // nominal M-cycles of all ops (branches not taken)
+    std::vector<MicroOp> ops;
+    // JIT backend: runs counted by the block core until `native` gets compiled (see CPU::runJit)
+    uint32_t execCount = 0;
+    int (*native)(CPU*) = nullptr;
+};
+
+/**
+ * Blocks are only cached for the cartridge ROM area (0x0000-0x7FFF) and indexed directly by PC.
+ * Any write into that area (or a boot ROM unmap) has to invalidate the blocks covering it.
+ */
+class BlockCache {
+public:
+    static const uint16_t CACHED_END = 0x8000;
+    // keeps invalidation of a single address a short scan
+    static const uint16_t MAX_BLOCK_BYTES = 64;
+    static const uint16_t MAX_BLOCK_OPS = 32;
+
+    BasicBlock* find(uint16_t pc) const { return blocks[pc].get(); }
+    BasicBlock* insert(std::unique_ptr<BasicBlock> block);
+    // drops every block overlapping [lo, hi]; returns true if any was dropped
+    bool invalidate(uint16_t lo, uint16_t hi);
+    void clear();
+    // frees blocks invalidated while they may still have been executing
+    void collect() { retired.clear(); }
+    bool empty() const { return count == 0; }
+
+private:
+    std::array<std::unique_ptr<BasicBlock>, CACHED_END> blocks{};
+    std::vector<std::unique_ptr<BasicBlock>> retired;
+    int count = 0;
+};
+
+
+#endif //NESEMULATOR_BLOCKCACHE_H
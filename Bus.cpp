@@ -3,6 +3,9 @@
 //
 
 #include "Bus.h"
+#include "DoctorLog.h"
+#include "Movie.h"
+#include "Trace.h"
 #include <cstdio>
 #include <unistd.h>
 #include <iostream>
@@ -12,6 +15,9 @@ Bus::Bus() {
     for (auto &i : RAM) i = 0x00;
     // connect the cpu
     cpu.connectBus(this);
+    mapPages();
+    timer.reset(clock);
+    scheduleTimer();
 }
 
 Bus::~Bus()=default;
@@ -22,7 +28,7 @@ void Bus::init(std::string romPath, bool skipBoot) {
     bool bootLoaded = false;
     if (!skipBoot) {
         bootLoaded = loadBootROM("DMG_ROM_2_2.bin");
-        if (!bootLoaded) {
+        if (!bootLoaded && verbose) {
             std::cout << "Warning: Could not load boot ROM. Falling back to skip-boot mode." << std::endl;
         }
     }
@@ -40,34 +46,140 @@ void Bus::init(std::string romPath, bool skipBoot) {
         bootRomEnabled = true;
         cpu.regs.pc = 0x0000;
     }
+    mapPages();
+    timer.reset(clock);
+    scheduleTimer();
+    updateInterrupts();
+    // LCD registers: off until the boot ROM switches it on, else as the boot ROM leaves them
+    static const uint8_t lcdRegs[12] = {0x91, 0x85, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFC, 0xFF, 0xFF, 0x00, 0x00};
+    for (int i = 0; i < 12; i++) RAM[0xFF40u + i] = bootRomEnabled ? 0x00 : lcdRegs[i];
+    ppu.reset(clock);
+    schedulePpu();
 }
 
-void Bus::WRITE(uint16_t addr, u_int8_t data) {
+void Bus::mapPages() {
+    for (int page = 0; page < PAGE_COUNT; page++) {
+        uint8_t* host = RAM.data() + (page << PAGE_SHIFT);
+        // the I/O page (0xFF00-0xFFFF) always goes through the handlers
+        readPages[page] = page < 0xFF ? host : nullptr;
+        // writes into the ROM area have to invalidate decoded blocks, VRAM and OAM writes have to
+        // let the PPU catch up first
+        writePages[page] = page >= 0xA0 && page < 0xFE ? host : nullptr;
+    }
+    mapCartridge(Cartridge::REMAP_ROM0 | Cartridge::REMAP_ROMX | Cartridge::REMAP_RAM);
+    if (bootRomEnabled) {
+        readPages[0] = bootRomData.size() >= 0x100 ? bootRomData.data() : nullptr;
+    }
+}
+
+void Bus::mapCartridge(uint8_t regions) {
+    if (!cartridge.loaded()) return;
+    if (regions & (Cartridge::REMAP_ROM0 | Cartridge::REMAP_ROMX)) {
+        int first = regions & Cartridge::REMAP_ROM0 ? 0x00 : 0x40;
+        int last = regions & Cartridge::REMAP_ROMX ? 0x80 : 0x40;
+        for (int page = first; page < last; page++) {
+            // never written through: writePages stays nullptr for the whole ROM area
+            readPages[page] = const_cast<uint8_t*>(cartridge.romPage((uint16_t) (page << PAGE_SHIFT)));
+        }
+        // the boot ROM overlay stays on top of bank 0
+        if (bootRomEnabled && first == 0) readPages[0] = bootRomData.size() >= 0x100 ? bootRomData.data() : nullptr;
+    }
+    if (regions & Cartridge::REMAP_RAM) {
+        for (int page = 0xA0; page < 0xC0; page++) {
+            uint8_t* host = cartridge.ramPage((uint16_t) (page << PAGE_SHIFT));
+            readPages[page] = host;
+            writePages[page] = host;
+        }
+    }
+}
+
+void Bus::writeSlow(uint16_t addr, u_int8_t data) {
     // Handle Boot ROM unmapping
     if (addr == 0xFF50 && bootRomEnabled && data != 0) {
         bootRomEnabled = false;
+        mapPages();
+        // blocks decoded from the boot ROM overlay are stale now
+        cpu.invalidateBlocks(0x0000, 0x00FF);
         return; // The write to 0xFF50 itself isn't stored in RAM usually, but if needed we can fall through
     }
 
-    // write the contents into memory
-    // into the correct memory range
-    if (addressInRange(addr))
+    if (addr < 0x8000u && cartridge.loaded()) {
+        // MBC registers: a bank switch changes the code behind the blocks decoded from that area
+        uint8_t remap = cartridge.write(addr, data, now());
+        if (!remap) return;
+        mapCartridge(remap);
+        if (remap & Cartridge::REMAP_ROM0) cpu.invalidateBlocks(0x0000, 0x3FFF);
+        if (remap & Cartridge::REMAP_ROMX) cpu.invalidateBlocks(0x4000, 0x7FFF);
+        return;
+    }
+    if (addr >= 0xA000u && addr < 0xC000u && cartridge.loaded()) {
+        cartridge.writeRam(addr, data, now());
+        return;
+    }
+
+    // writes into the ROM area change code the CPU may have decoded already
+    if (addr < 0x8000u) cpu.invalidateBlocks(addr, addr);
+
+    // VRAM/OAM: lines the PPU still owes have to be drawn from the old contents
+    if ((addr >= 0x8000u && addr < 0xA000u) || (addr >= 0xFE00u && addr < 0xFF00u)) {
+        ppu.catchUp(now());
+        RAM[addr] = data;
+        if (addr < 0x9800u) ppu.tileWritten(addr);
+        return;
+    }
+
+    // NOTE: CPU writes to I/O end the current chunk (CPU::runBreak), so the events rescheduled here
+    // are picked up right after the writing instruction
+    if (addr == 0xFF00u) {
+        // only the line select bits can be written
+        RAM[addr] = data & 0x30u;
+        updateJoypad();
+        return;
+    }
+    if (addr >= 0xFF04u && addr <= 0xFF07u) {
+        syncTimer();
+        if (timer.write(addr, data)) requestInterrupt(IRQ_TIMER);
+        scheduleTimer();
+        return;
+    }
+    if (addr == 0xFF46u) {
+        // OAM DMA, done at once: 160 bytes from data * 0x100
+        ppu.catchUp(now());
+        for (uint16_t i = 0; i < 0xA0u; i++) RAM[0xFE00u + i] = READ((uint16_t) ((data << 8u) + i));
         RAM[addr] = data;
+        return;
+    }
+    if (addr >= 0xFF40u && addr <= 0xFF4Bu) {
+        ppu.catchUp(now());
+        uint8_t irq = ppu.write(addr, data, now());
+        if (irq) requestInterrupt(irq);
+        schedulePpu();
+        return;
+    }
+    if (addr == 0xFF02u && (data & 0x81u) == 0x81u && !scheduler.scheduled(Scheduler::EVENT_SERIAL)) {
+        // 8 bits at 8192Hz on the internal clock
+        scheduler.schedule(Scheduler::EVENT_SERIAL, now() + 8 * 512);
+    }
+
+    RAM[addr] = data;
+    if (addr == 0xFF0Fu || addr == 0xFFFFu) updateInterrupts();
 }
 
-uint8_t Bus::READ(uint16_t addr) {
-    // Read from Boot ROM if enabled and in range
+uint8_t Bus::readSlow(uint16_t addr) {
+    // Read from a (short) Boot ROM if enabled and in range
     if (bootRomEnabled && addr < 0x0100) {
         if (addr < bootRomData.size()) {
             return bootRomData[addr];
         }
         return 0x00;
     }
-
-    if (addressInRange(addr))
-        return RAM[addr];
-    // If there is an illegal read
-    return LOW;
+    if (cartridge.loaded() && addr >= 0xA000u && addr < 0xC000u) return cartridge.readRam(addr, now());
+    // DIV and TIMA, STAT and LY are only brought up to date when somebody looks
+    if (addr == 0xFF04u || addr == 0xFF05u) syncTimer();
+    if (addr == 0xFF00u) return (uint8_t) (0xC0u | (RAM[addr] & 0x30u) | joypadRead());
+    if (addr == 0xFF44u && doctorLY) return 0x90;
+    if (addr == 0xFF41u || addr == 0xFF44u) ppu.updateStatus(now());
+    return RAM[addr];
 }
 
 bool Bus::loadBootROM(const std::string& path) {
@@ -86,47 +198,135 @@ bool Bus::loadBootROM(const std::string& path) {
 }
 
 void Bus::loadCartridge(const std::string& path) {
-    FILE* file = fopen(path.c_str(), "rb");
-    if (!file) {
+    if (!cartridge.load(path, batterySave)) {
         std::cerr << "Failed to load ROM: " << path << std::endl;
-        return;
+    } else if (verbose) {
+        std::cout << "Loaded " << cartridge.describe() << "." << std::endl;
     }
-
-    // Read directly into RAM
-    size_t read = fread(RAM.data(), 1, RAM.size(), file);
-    std::cout << "Loaded " << read << " bytes from ROM into RAM." << std::endl;
-    fclose(file);
 }
 
 void Bus::run() {
-    int cycles;
-    while (true) {
-        // TODO: handle HALT state
-        if (cpu.unpaused) {
-            if (!cpu.HALT_FLAG) {
-                // process OPCODE and check flags
-                cycles = cpu.stepCPU();
-
-                // handle the cycles
-                cpu.handleCycles(cycles);
-
-                // handle any interrupts
-                // I was reading that the processor let's any instruction complete
-                // and then handles interrupts
-                cpu.handleInterrupts();
-
-                cpu.printSummary();
-
-                // Check for serial output (Blargg's test ROMs write to 0xFF02)
-                if (RAM[0xff02u] == 0x81) {
-                    uint8_t c = RAM[0xff01u];
-                    printf("%c", c);
-                    RAM[0xff02u] = 0x0u;
-                }
-            }
-        } else {
+    while (cpu.unpaused) {
+        if (haltedForever()) {
+            printf("\nCPU halted with no interrupt left that could wake it up (PC 0x%04x)\n", cpu.regs.pc);
             break;
         }
+        // process OPCODE(s) up to the next event (or skip a HALT up to it), then the events and interrupts
+        // NOTE: tracing needs every single step
+        int maxCycles = INT_MAX;
+#if GB_TRACE
+        bool halted = cpu.HALT_FLAG;
+        bool recording = traceRecorder && !halted;
+        bool logging = doctorLog && !halted;
+        if ((traceLevel != CPU::TRACE_NONE || recording || logging) && !halted) maxCycles = 1;
+        if (logging) doctorLog->write(*this);
+        if (recording) traceRecorder->before(*this);
+        uint64_t start = clock;
+#endif
+        runChunk(maxCycles);
+
+#if GB_TRACE
+        if (recording) traceRecorder->after((int) ((clock - start) / 4));
+        if (traceLevel != CPU::TRACE_NONE && !halted) cpu.printSummary(traceLevel);
+#endif
         /* usleep(1000000); */
     }
 }
+
+int Bus::runChunk(int maxCycles) {
+    uint64_t next = scheduler.nextTime();
+    int budget = maxCycles;
+    if (next != Scheduler::NEVER) {
+        uint64_t until = next > clock ? (next - clock + 3) / 4 : 1;
+        if (until < (uint64_t) budget) budget = (int) until;
+    }
+    int cycles;
+    if (cpu.HALT_FLAG) {
+        // HALT/STOP: only an interrupt request ends it, and those only come from events,
+        // so nothing observable happens until the next one. Skip straight to it.
+        // A request raised outside a chunk (setButtons, loadState) is already pending and ends it now.
+        if (pendingIrq) cycles = 0;
+        else if (next == Scheduler::NEVER) return 0;
+        else cycles = budget;
+    } else {
+        cycles = cpu.execute(budget);
+    }
+    clock += (uint64_t) cycles * 4;
+
+    // the EI delay: IME turns on after the instruction following EI
+    if (cpu.interrupts_cycles_left_to_enabled == 2) {
+        cpu.interrupts_cycles_left_to_enabled = 1;
+        scheduler.schedule(Scheduler::EVENT_EI, clock + 4);
+    }
+
+    Scheduler::EVENT event;
+    while (scheduler.popDue(clock, event)) handleEvent(event);
+
+    // I was reading that the processor let's any instruction complete
+    // and then handles interrupts
+    if (pendingIrq) {
+        // any enabled request ends a HALT, IME only decides whether it is dispatched as well
+        cpu.HALT_FLAG = false;
+        if (cpu.interrupts_enabled) cpu.handleInterrupts();
+    }
+    return cycles;
+}
+
+void Bus::handleEvent(Scheduler::EVENT event) {
+    switch (event) {
+        case Scheduler::EVENT_TIMA:
+            syncTimer();
+            scheduleTimer();
+            break;
+        case Scheduler::EVENT_PPU: {
+            uint8_t irq = ppu.event();
+            if (irq) requestInterrupt(irq);
+            schedulePpu();
+            break;
+        }
+        case Scheduler::EVENT_SERIAL:
+            // no link partner: 0xFF is shifted in, the transfer bit clears and the serial interrupt is requested
+            if (serialEcho) printf("%c", RAM[0xff01u]);
+            if (serialCapture) serialCapture->push_back((char) RAM[0xff01u]);
+            RAM[0xff01u] = 0xFF;
+            RAM[0xff02u] &= 0x7Fu;
+            requestInterrupt(IRQ_SERIAL);
+            break;
+        case Scheduler::EVENT_EI:
+            cpu.interrupts_cycles_left_to_enabled = 0;
+            cpu.interrupts_enabled = true;
+            break;
+        case Scheduler::EVENT_INPUT:
+            if (movie) movie->event();
+            break;
+        default:
+            break;
+    }
+}
+
+void Bus::setButtons(uint8_t pressed) {
+    held = pressed;
+    updateJoypad();
+}
+
+void Bus::updateJoypad() {
+    uint8_t lines = joypadRead();
+    if (joypadLines & ~lines) requestInterrupt(IRQ_JOYPAD);
+    joypadLines = lines;
+}
+
+void Bus::syncTimer() {
+    if (timer.catchUp(now())) requestInterrupt(IRQ_TIMER);
+}
+
+void Bus::schedulePpu() {
+    uint64_t next = ppu.nextEvent();
+    if (next != Scheduler::NEVER) scheduler.schedule(Scheduler::EVENT_PPU, next);
+    else scheduler.cancel(Scheduler::EVENT_PPU);
+}
+
+void Bus::scheduleTimer() {
+    uint64_t overflow = timer.nextOverflow();
+    if (overflow != Scheduler::NEVER) scheduler.schedule(Scheduler::EVENT_TIMA, overflow);
+    else scheduler.cancel(Scheduler::EVENT_TIMA);
+}
@@ -3,7 +3,12 @@
 //
 #include <cstdint>
 #include "CPU.h"
+#include "Cartridge.h"
+#include "Scheduler.h"
+#include "Timer.h"
+#include "PPU.h"
 #include <array>
+#include <climits>
 #include <vector>
 #include <string>
 
@@ -13,6 +18,10 @@
 using std::uint16_t;
 using std::uint8_t;
 
+class TraceRecorder;
+class DoctorLog;
+class MovieSession;
+
 
 /**
  * Bus class
@@ -30,26 +39,176 @@ public:
 public:
     CPU cpu;
     std::array<uint8_t, 64 * 1024> RAM{};
+    // ROM and external RAM; without a cartridge loaded, 0x0000-0x7FFF and 0xA000-0xBFFF are plain RAM
+    Cartridge cartridge;
+
+    // Per-instruction tracing in run(). Defaults to TRACE_NONE (headless turbo).
+    // NOTE: when built with -DGB_TRACE=OFF the tracing code is compiled out entirely and this is ignored.
+    CPU::TRACE_LEVEL traceLevel = CPU::TRACE_NONE;
+    // ... and/or a binary trace of every instruction run() executes (Trace.h; same GB_TRACE switch)
+    TraceRecorder* traceRecorder = nullptr;
+    // ... and/or a gameboy-doctor log line before every instruction (DoctorLog.h; same GB_TRACE switch)
+    DoctorLog* doctorLog = nullptr;
+    // LY (0xFF44) always reads 0x90, as it did for gameboy-doctor's reference logs (without it they go
+    // apart at the first wait for VBlank)
+    bool doctorLY = false;
+
+    // Timing: absolute clock (T-)cycles since power on, and everything due at some point of it
+    uint64_t clock = 0;
+    Scheduler scheduler;
+    Timer timer{RAM.data() + 0xFF00};
+    PPU ppu{RAM.data()};
+    // Echo completed serial transfers (Blargg's test ROMs print through them) to stdout
+    bool serialEcho = true;
+    // ... and/or append them here (batch runs collect each instance's output separately)
+    std::string* serialCapture = nullptr;
+    // Report what init loaded on stdout (set before init; batch runs keep the console to themselves)
+    bool verbose = true;
+    // Keep battery backed cartridge RAM in its .sav file (set before init)
+    bool batterySave = true;
+    // Running hash of every CPU write (address and value, in order), for comparing two runs without
+    // comparing their memory (see Lockstep). Off by default; set before running, the JIT reads it at compile time.
+    bool hashWrites = false;
+    uint64_t writeHash = 0;
+    void hashWrite(uint16_t addr, uint8_t data) {
+        writeHash = (writeHash ^ ((uint64_t) addr << 8u | data)) * WRITE_HASH_PRIME;
+    }
+    static const uint64_t WRITE_HASH_PRIME = 0x100000001B3ull;
+
+    /**
+     * Memory map in 256 byte pages. A page is either a direct host pointer (plain ROM/RAM, the
+     * current cartridge banks) or nullptr, in which case the access goes through readSlow/writeSlow
+     * (I/O, boot ROM overlay, MBC registers). Call mapPages() whenever what backs a page changes.
+     * NOTE: ROM read pages point into a read-only mapping, only write pages may be written through.
+     */
+    static const int PAGE_SHIFT = 8;
+    static const int PAGE_COUNT = 0x10000 >> PAGE_SHIFT;
+    std::array<uint8_t*, PAGE_COUNT> readPages{};
+    std::array<uint8_t*, PAGE_COUNT> writePages{};
+
+    // Interrupt request bits in IF (0xFF0F) and IE (0xFFFF), in priority order
+    enum INTERRUPT : uint8_t {
+        IRQ_VBLANK = 0x01,
+        IRQ_LCD_STAT = 0x02,
+        IRQ_TIMER = 0x04,
+        IRQ_SERIAL = 0x08,
+        IRQ_JOYPAD = 0x10,
+    };
+    // IE & IF, kept up to date so checking for interrupts is a single load.
+    // NOTE: IF and IE must only change through writeSlow, requestInterrupt or acknowledgeInterrupt.
+    uint8_t pendingInterrupts() const { return pendingIrq; }
+    void requestInterrupt(uint8_t mask) { RAM[0xFF0Fu] |= mask; updateInterrupts(); }
+    void acknowledgeInterrupt(uint8_t mask) { RAM[0xFF0Fu] &= (uint8_t) ~mask; updateInterrupts(); }
+
+    // Joypad buttons, one bit each: the direction keys are P1's lines with bit 4 selected (0xFF00 bits
+    // 0-3), the others its lines with bit 5 selected
+    enum BUTTON : uint8_t {
+        BUTTON_RIGHT = 0x01,
+        BUTTON_LEFT = 0x02,
+        BUTTON_UP = 0x04,
+        BUTTON_DOWN = 0x08,
+        BUTTON_A = 0x10,
+        BUTTON_B = 0x20,
+        BUTTON_SELECT = 0x40,
+        BUTTON_START = 0x80,
+    };
+    // The buttons held down from now on. A selected line going low requests the joypad interrupt.
+    // NOTE: only call it between runChunk calls (or from an event), like loading a state.
+    void setButtons(uint8_t pressed);
+    uint8_t buttons() const { return held; }
+    // Input movie being recorded or played back (Movie.h); it changes the buttons through EVENT_INPUT
+    MovieSession* movie = nullptr;
 
 private:
     std::vector<uint8_t> bootRomData;
     bool bootRomEnabled = false;
+    uint8_t pendingIrq = 0;
+    uint8_t held = 0;
+    uint8_t joypadLines = 0x0F; // P1 bits 0-3 as last seen, low = pressed
 
-    static const uint16_t LOW = 0x0000; // NOTE: GB boots up with PC at 0x0100
-    static const uint16_t HI = 0xFFFF;
-    static bool addressInRange(uint16_t addr) {
-        return (addr >= LOW && addr <= HI);
+    void updateInterrupts() { pendingIrq = RAM[0xFF0Fu] & RAM[0xFFFFu] & 0x1Fu; }
+    // P1 bits 0-3 for the selected lines and held buttons
+    uint8_t joypadRead() const {
+        uint8_t select = RAM[0xFF00u];
+        uint8_t low = 0;
+        if (!(select & 0x10u)) low |= held & 0x0Fu;
+        if (!(select & 0x20u)) low |= held >> 4u;
+        return (uint8_t) (~low & 0x0Fu);
     }
+    void updateJoypad();
 
 private:
     bool loadBootROM(const std::string& path);
     void loadCartridge(const std::string& path);
+    void mapPages();
+    // Points the pages of the given Cartridge::REMAP regions at the current banks
+    void mapCartridge(uint8_t regions);
 
 public:
-    void WRITE(uint16_t addr, uint8_t data);
-    uint8_t READ(uint16_t addr);
+    void WRITE(uint16_t addr, uint8_t data) {
+        uint8_t* page = writePages[addr >> PAGE_SHIFT];
+        if (page) page[addr & 0xFFu] = data;
+        else writeSlow(addr, data);
+    }
+    uint8_t READ(uint16_t addr) {
+        const uint8_t* page = readPages[addr >> PAGE_SHIFT];
+        return page ? page[addr & 0xFFu] : readSlow(addr);
+    }
+    // Handlers for the pages without a direct mapping
+    void writeSlow(uint16_t addr, uint8_t data);
+    uint8_t readSlow(uint16_t addr);
     void run();
+    // Runs the CPU up to the next scheduled event (at most maxCycles M-cycles), then services every
+    // event that became due and pending interrupts. Returns the M-cycles run.
+    int runChunk(int maxCycles = INT_MAX);
+    // HALT/STOP with nothing pending, and either no interrupt enabled in IE or no event scheduled that could
+    // request one (STOP is a HALT here, so a joypad wake-up goes through IE too)
+    bool haltedForever() const {
+        return cpu.HALT_FLAG && !pendingIrq &&
+               ((RAM[0xFFFFu] & 0x1Fu) == 0 || scheduler.nextTime() == Scheduler::NEVER);
+    }
+
+    // Exact current time: the start of the instruction the CPU is executing (or `clock` between chunks)
+    uint64_t now() const { return clock + (uint64_t) cpu.cyclesIntoRun() * 4; }
+
+    /**
+     * Save states (SaveState.cpp): the whole machine as a versioned, chunked binary blob, cheap enough
+     * to take every frame. Only valid between runChunk calls. Loading checks the blob was taken with the
+     * same cartridge and leaves the machine untouched (returning false) if anything doesn't fit.
+     * NOTE: chunks hold host byte order fields, so states only move between builds of the same
+     * STATE_VERSION on the same architecture.
+     */
+    static const uint32_t STATE_VERSION = 3;
+    void saveState(std::vector<uint8_t>& out);
+    bool loadState(const uint8_t* data, size_t size);
+    bool saveStateFile(const std::string& path);
+    bool loadStateFile(const std::string& path);
+
+private:
+    void handleEvent(Scheduler::EVENT event);
+    // Catch the timer registers up to now() / reschedule the TIMA overflow event
+    void syncTimer();
+    void scheduleTimer();
+    void schedulePpu();
 };
 
 
+// The CPU's memory accessors are the hottest path in the emulator: keep them inlinable
+inline uint8_t CPU::READ(u_int16_t addr, bool read_only) {
+    (void) read_only;
+    return bus->READ(addr);
+}
+
+inline void CPU::WRITE(u_int16_t addr, u_int8_t data) {
+    if (bus->hashWrites) bus->hashWrite(addr, data);
+    uint8_t* page = bus->writePages[addr >> Bus::PAGE_SHIFT];
+    if (page) {
+        page[addr & 0xFFu] = data;
+        return;
+    }
+    // I/O registers and IE can start timers, serial transfers or interrupts: hand control back to the Bus
+    if (addr >= 0xFF00u && (addr < 0xFF80u || addr == 0xFFFFu)) runBreak = true;
+    bus->writeSlow(addr, data);
+}
+
 #endif //NESEMULATOR_BUS_H
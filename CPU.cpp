@@ -5,6 +5,10 @@
 
 #include "CPU.h"
 #include "Bus.h"
+#include "OpcodeTable.h"
+#if GB_JIT
+#include "Jit.h"
+#endif
 #include <cstdint>
 
 using std::uint8_t;
@@ -91,7 +95,10 @@ CPU::CPU() = default;
 
 CPU::~CPU()=default;
 
-void CPU::printSummary() {
+void CPU::printSummary(TRACE_LEVEL level) {
+    if (level == TRACE_NONE) return;
+    flushFlags();
+
     // print regs
     dumpRegs();
 
@@ -99,7 +106,8 @@ void CPU::printSummary() {
     dumpFlags();
 
     // dump stack
-    dumpStack();
+    // NOTE: this walks memory from 0xCFFF down to SP through the bus, so it is by far the most expensive part
+    if (level >= TRACE_FULL) dumpStack();
 
 }
 
@@ -112,10 +120,10 @@ void CPU::dumpRegs() const {
 }
 
 void CPU::dumpFlags() const {
-    PRINTREG8s("Z", (bool)(regs.af.F & 0x80u));
-    PRINTREG8s("N", (bool)(regs.af.F & 0x60u));
-    PRINTREG8s("H", (bool)(regs.af.F & 0x40u));
-    PRINTREG8s("C", (bool)(regs.af.F & 0x20u));
+    PRINTREG8s("Z", (bool)(regs.af.F & Z));
+    PRINTREG8s("N", (bool)(regs.af.F & N));
+    PRINTREG8s("H", (bool)(regs.af.F & H));
+    PRINTREG8s("C", (bool)(regs.af.F & C));
     NEWLINE;
 }
 
@@ -127,21 +135,10 @@ void CPU::dumpStack() {
     NEWLINE;
 }
 
-uint8_t CPU::READ(u_int16_t addr, bool read_only)
-{
-    // check for range validity occurs within bus implementation
-    return bus->READ(addr);
-}
-
-void CPU::WRITE(u_int16_t addr, u_int8_t data)
-{
-    bus->WRITE(addr, data);
-}
-
 uint16_t CPU::popFromStack() {
     uint8_t n1 = READ(regs.sp++);
     uint8_t n2 = READ(regs.sp++);
-    return (uint8_t)(n2 << 8u) | n1;
+    return (uint16_t)(n2 << 8u) | n1;
 }
 
 void CPU::pushToStack(uint16_t ADDR) {
@@ -165,7 +162,7 @@ int CPU::POP_REG(uint16_t& REG) {
     regs.sp++;
     uint8_t high = READ(regs.sp);
     regs.sp++;
-    REG = ((uint8_t)(high << 8u)) | low;
+    REG = (uint16_t)(high << 8u) | low;
     return 3;
 }
 
@@ -256,6 +253,8 @@ int8_t CPU::ReadI() {
 }
 
 void CPU::SetFlag(CPU::Z80_FLAGS f, bool v) {
+    // the pending operation owns all four flags until it is folded in
+    if (lazyFlags.op != FLAGS_CLEAN) flushFlags();
     // if we are setting the flag true
     // OR a bitwise shift
     // if we want to set it false
@@ -267,27 +266,65 @@ void CPU::SetFlag(CPU::Z80_FLAGS f, bool v) {
     }
 }
 
-uint8_t CPU::GetFlag(CPU::Z80_FLAGS f) const {
-    return (regs.f & f) > 0 ? 1 : 0;
+uint8_t CPU::GetFlag(CPU::Z80_FLAGS f) {
+    if (lazyFlags.op != FLAGS_CLEAN) flushFlags();
+    return (regs.af.F & f) > 0 ? 1 : 0;
+}
+
+/**
+ * Compute Z/N/H/C of the last recorded ALU operation and store them in F.
+ * NOTE: this is the only place the 8-bit ALU flags are actually evaluated.
+ */
+void CPU::flushFlags() {
+    const LAZY_FLAGS& l = lazyFlags;
+    uint8_t f = 0;
+    switch (l.op) {
+        case FLAGS_CLEAN:
+            return;
+        case FLAGS_ADD:
+            if (((l.lhs & 0x0Fu) + (l.rhs & 0x0Fu) + l.carry) > 0x0Fu) f |= H;
+            if (l.result > 0xFFu) f |= C;
+            break;
+        case FLAGS_SUB:
+            f |= N;
+            if (((l.rhs & 0x0Fu) + l.carry) > (l.lhs & 0x0Fu)) f |= H;
+            if (l.result > 0xFFu) f |= C;
+            break;
+        case FLAGS_INC:
+            if ((l.lhs & 0x0Fu) == 0x0Fu) f |= H;
+            if (l.carry) f |= C;
+            break;
+        case FLAGS_DEC:
+            f |= N;
+            if ((l.result & 0x0Fu) == 0x0Fu) f |= H;
+            if (l.carry) f |= C;
+            break;
+        case FLAGS_AND:
+            f |= H;
+            break;
+        case FLAGS_LOGIC:
+            if (l.carry) f |= C;
+            break;
+    }
+    if ((uint8_t) l.result == 0) f |= Z;
+    regs.af.F = (uint8_t)(f | (regs.af.F & 0x0Fu));
+    lazyFlags.op = FLAGS_CLEAN;
 }
 
 // Z affected, N unset, H affected
 void CPU::INCREMENT_8_BIT_REG(uint8_t& reg) {
-    // grab the original value
     auto r = reg;
-    // Increment the value
     reg++;
-    SetFlag(Z, IS_ZERO_8(reg));
-    SetFlag(N, false);
-    SetFlag(H, HAS_HALF_CARRY_8(r, 0x01u));
+    // C is left alone
+    setFlagsLazy(FLAGS_INC, r, 0x01u, lazyCarry(), reg);
 }
 
 // Z affected, N set, H affected
 void CPU::DECREMENT_8_BIT_REG(uint8_t& reg) {
+    auto r = reg;
     reg--;
-    SetFlag(Z, IS_ZERO_8(reg));
-    SetFlag(N, true);
-    SetFlag(H, HAS_HALF_CARRY_DECREMENT_8(reg));
+    // C is left alone
+    setFlagsLazy(FLAGS_DEC, r, 0x01u, lazyCarry(), reg);
 }
 
 /**
@@ -311,15 +348,10 @@ int CPU::ADD_HL_REG(uint16_t REG) {
 int CPU::ADD_A_REG(uint8_t REG) {
     auto n1 = regs.af.A;
     auto n2 = REG;
-    regs.af.A = n1 + n2;
-    // set Z flag if the result is zero
-    SetFlag(Z, IS_ZERO_8(regs.af.A));
-    // unset N flag
-    SetFlag(N, false);
-    // set H if overflow from bit 3
-    SetFlag(H, HAS_HALF_CARRY_8(n1, n2));
-    // set C if overflow from bit 7
-    SetFlag(C, HAS_CARRY_8(regs.af.A, n1, n2));
+    uint16_t res = n1 + n2;
+    regs.af.A = (uint8_t) res;
+    // Z if the result is zero, N unset, H if overflow from bit 3, C if overflow from bit 7
+    setFlagsLazy(FLAGS_ADD, n1, n2, 0, res);
     return 1;
 }
 
@@ -329,18 +361,7 @@ int CPU::ADD_A_REG(uint8_t REG) {
  * 2 cycles
  */
 int CPU::ADD_A_n8(uint8_t n) {
-    auto n1 = regs.af.A;
-    auto n2 = n;
-    regs.af.A = n1 + n2;
-    // set Z flag if the result is zero
-    SetFlag(Z, IS_ZERO_8(regs.af.A));
-    // unset N flag
-    SetFlag(N, false);
-    // set H if overflow from bit 3
-    SetFlag(H, HAS_HALF_CARRY_8(n1, n2));
-    // set C if overflow from bit 7
-    SetFlag(C, HAS_CARRY_8(regs.af.A, n1, n2));
-    return 2;
+    return ADD_A_REG(n) + 1;
 }
 
 int CPU::ADD_A_Addr_REG16(uint16_t REG) {
@@ -378,35 +399,18 @@ int CPU::ADD_SP_i8(int8_t i) {
 }
 
 int CPU::ADC_A_REG(uint8_t REG) {
-    auto c = GetFlag(C);
+    auto c = lazyCarry();
     auto n1 = regs.af.A;
     auto n2 = REG;
-    regs.af.A = n1 + n2 + c;
-    // set Z flag if the result is zero
-    SetFlag(Z, IS_ZERO_8(regs.af.A));
-    // unset N flag
-    SetFlag(N, false);
-    // set H if overflow from bit 3
-    SetFlag(H, HAS_HALF_CARRY_8c(n1, n2, c));
-    // set C if overflow from bit 7
-    SetFlag(C, HAS_CARRY_8_c(regs.af.A, n1, n2, c));
+    uint16_t res = n1 + n2 + c;
+    regs.af.A = (uint8_t) res;
+    // same flags as ADD, the carry takes part in H and C
+    setFlagsLazy(FLAGS_ADD, n1, n2, c, res);
     return 1;
 }
 
 int CPU::ADC_A_n8(uint8_t n) {
-    auto c = GetFlag(C);
-    auto n1 = regs.af.A;
-    auto n2 = n;
-    regs.af.A = n1 + n2 + c;
-    // set Z flag if the result is zero
-    SetFlag(Z, IS_ZERO_8(regs.af.A));
-    // unset N flag
-    SetFlag(N, false);
-    // set H if overflow from bit 3
-    SetFlag(H, HAS_HALF_CARRY_8c(n1, n2, c));
-    // set C if overflow from bit 7
-    SetFlag(C, HAS_CARRY_8_c(regs.af.A, n1, n2, c));
-    return 2;
+    return ADC_A_REG(n) + 1;
 }
 
 int CPU::ADC_A_Addr_REG16(uint16_t REG) {
@@ -423,16 +427,12 @@ int CPU::ADC_A_Addr_REG16(uint16_t REG) {
 int CPU::SUB_A_REG(uint8_t REG) {
     auto n1 = regs.af.A;
     auto n2 = REG;
-    regs.af.A = n1 - n2;
-    // Set if A becomes 0
-    SetFlag(Z, IS_ZERO_8(regs.af.A));
-    // N is set
-    SetFlag(N, true);
-    // set H if there is a borrow from bit 4
-    SetFlag(H, HAS_HALF_BORROW_8(n1, n2));
-    // set C is there is a borrow (REG > A)
+    // a borrow wraps the 16-bit result above 0xFF
+    uint16_t res = n1 - n2;
+    regs.af.A = (uint8_t) res;
+    // Z if A becomes 0, N set, H if borrow from bit 4, C if borrow (REG > A)
     // See https://rednex.github.io/rgbds/gbz80.7.html#SUB_A,r8
-    SetFlag(C, HAS_BORROW_8(n1, n2));
+    setFlagsLazy(FLAGS_SUB, n1, n2, 0, res);
     return 1;
 }
 
@@ -442,19 +442,7 @@ int CPU::SUB_A_REG(uint8_t REG) {
  * 2 cycles
  */
 int CPU::SUB_A_n8(uint8_t n) {
-    auto n1 = regs.af.A;
-    auto n2 = n;
-    regs.af.A = n1 - n2;
-    // Set if A becomes 0
-    SetFlag(Z, IS_ZERO_8(regs.af.A));
-    // N is set
-    SetFlag(N, true);
-    // set H if there is a borrow from bit 4
-    SetFlag(H, HAS_HALF_BORROW_8(n1, n2));
-    // set C is there is a borrow (REG > A)
-    // See https://rednex.github.io/rgbds/gbz80.7.html#SUB_A,r8
-    SetFlag(C, HAS_BORROW_8(n1, n2));
-    return 2;
+    return SUB_A_REG(n) + 1;
 }
 
 
@@ -467,16 +455,9 @@ int CPU::SUB_A_n8(uint8_t n) {
 int CPU::CP_A_REG(uint8_t REG) {
     auto n1 = regs.af.A;
     auto n2 = REG;
-    auto res = n1 - n2;
-    // Set if A becomes 0
-    SetFlag(Z, IS_ZERO_8(res));
-    // N is set
-    SetFlag(N, true);
-    // set H if there is a borrow from bit 4
-    SetFlag(H, HAS_HALF_BORROW_8(n1, n2));
-    // set C is there is a borrow (REG > A)
-    // See https://rednex.github.io/rgbds/gbz80.7.html#SUB_A,r8
-    SetFlag(C, HAS_BORROW_8(n1, n2));
+    uint16_t res = n1 - n2;
+    // same flags as SUB, A is left alone
+    setFlagsLazy(FLAGS_SUB, n1, n2, 0, res);
     return 1;
 }
 
@@ -511,16 +492,11 @@ int CPU::CP_A_Addr_REG16(uint16_t REG) {
 int CPU::SBC_A_REG(uint8_t REG) {
     auto n1 = regs.af.A;
     auto n2 = REG;
-    auto c = GetFlag(C);
-    regs.af.A = n1 - n2 - c;
-    // Set Z if A is zero
-    SetFlag(Z, regs.af.A);
-    // Set N
-    SetFlag(N, true);
-    // Set if borrow from bit 4
-    SetFlag(H, HAS_HALF_BORROW_8c(n1, n2, c));
-    // Set if borrow (REG + c > A)
-    SetFlag(C, HAS_BORROW_8c(n1, n2, c));
+    auto c = lazyCarry();
+    uint16_t res = n1 - n2 - c;
+    regs.af.A = (uint8_t) res;
+    // Z if A is zero, N set, H if borrow from bit 4, C if borrow (REG + c > A)
+    setFlagsLazy(FLAGS_SUB, n1, n2, c, res);
     return 1;
 }
 
@@ -532,19 +508,7 @@ int CPU::SBC_A_REG(uint8_t REG) {
  * @return int
  */
 int CPU::SBC_A_n8(uint8_t n) {
-    auto n1 = regs.af.A;
-    auto n2 = n;
-    auto c = GetFlag(C);
-    regs.af.A = n1 - n2 - c;
-    // Set Z if A is zero
-    SetFlag(Z, regs.af.A);
-    // Set N
-    SetFlag(N, true);
-    // Set if borrow from bit 4
-    SetFlag(H, HAS_HALF_BORROW_8c(n1, n2, c));
-    // Set if borrow (REG + c > A)
-    SetFlag(C, HAS_BORROW_8c(n1, n2, c));
-    return 2;
+    return SBC_A_REG(n) + 1;
 }
 
 int CPU::SBC_A_Addr_REG16(uint16_t REG) {
@@ -559,10 +523,8 @@ int CPU::SBC_A_Addr_REG16(uint16_t REG) {
  */
 int CPU::AND_A_REG(uint8_t REG) {
     regs.af.A &= REG;
-    SetFlag(Z, regs.af.A);
-    SetFlag(N, false);
-    SetFlag(H, true);
-    SetFlag(C, false);
+    // Z affected, N unset, H set, C unset
+    setFlagsLazy(FLAGS_AND, regs.af.A, REG, 0, regs.af.A);
     return 1;
 }
 
@@ -574,12 +536,7 @@ int CPU::AND_A_REG(uint8_t REG) {
  * @return
  */
 int CPU::AND_A_n8(uint8_t n) {
-    regs.af.A &= n;
-    SetFlag(Z, regs.af.A);
-    SetFlag(N, false);
-    SetFlag(H, true);
-    SetFlag(C, false);
-    return 2;
+    return AND_A_REG(n) + 1;
 }
 
 /**
@@ -599,12 +556,8 @@ int CPU::AND_A_Addr_REG16(uint16_t REG) {
  */
 int CPU::XOR_A_REG(uint8_t REG) {
     regs.af.A ^= REG;
-    // Set Z if result is zero
-    SetFlag(Z, IS_ZERO_8(regs.af.A));
-    // rest are unset
-    SetFlag(N, false);
-    SetFlag(H, false);
-    SetFlag(C, false);
+    // Set Z if result is zero, rest are unset
+    setFlagsLazy(FLAGS_LOGIC, regs.af.A, REG, 0, regs.af.A);
     return 1;
 }
 
@@ -624,13 +577,9 @@ int CPU::XOR_A_Addr_REG16(uint16_t REG) {
  * Z affected, rest are unset
  */
 int CPU::OR_A_REG(uint8_t REG) {
-    regs.af.A ^= REG;
-    // Set Z if result is zero
-    SetFlag(Z, IS_ZERO_8(regs.af.A));
-    // rest are unset
-    SetFlag(N, false);
-    SetFlag(H, false);
-    SetFlag(C, false);
+    regs.af.A |= REG;
+    // Set Z if result is zero, rest are unset
+    setFlagsLazy(FLAGS_LOGIC, regs.af.A, REG, 0, regs.af.A);
     return 1;
 }
 
@@ -903,16 +852,10 @@ int CPU::SET_u3_Addr_REG16(int u3, const uint16_t &REG) {
  */
 int CPU::RL_REG(uint8_t& REG) {
     auto newC = (uint8_t)(REG >> 7u) & 0x01u; // either 0x00 or 0x01
-    auto oldC = GetFlag(C);
+    auto oldC = lazyCarry();
     REG = (uint8_t)(REG << 1u) | oldC;
-    // Set Z if result is zero
-    SetFlag(Z, IS_ZERO_8(REG));
-    // N unset
-    SetFlag(N, false);
-    // H unset
-    SetFlag(H, false);
-    // C  set according to the result
-    SetFlag(C, newC);
+    // Z if the result is zero, N unset, H unset, C set according to the result
+    setFlagsLazy(FLAGS_LOGIC, REG, 0, newC, REG);
     return 2;
 }
 
@@ -925,17 +868,11 @@ int CPU::RL_REG(uint8_t& REG) {
 int CPU::RL_Addr_REG16(const uint16_t& REG) {
     uint8_t byte = READ(REG);
     auto newC = (uint8_t)(byte >> 7u) & 0x01u; // either 0x00 or 0x01
-    auto oldC = GetFlag(C);
+    auto oldC = lazyCarry();
     byte = (uint8_t)(byte << 1u) | oldC;
     WRITE(REG, byte);
-    // Set Z if result is zero
-    SetFlag(Z, IS_ZERO_8(byte));
-    // N unset
-    SetFlag(N, false);
-    // H unset
-    SetFlag(H, false);
-    // C  set according to the result
-    SetFlag(C, newC);
+    // Z if the result is zero, N unset, H unset, C set according to the result
+    setFlagsLazy(FLAGS_LOGIC, byte, 0, newC, byte);
     return 4;
 }
 
@@ -947,12 +884,10 @@ int CPU::RL_Addr_REG16(const uint16_t& REG) {
  */
 int CPU::RR_REG(uint8_t& REG) {
     auto newC = (uint8_t)(REG & 0x01u);
-    auto oldC = GetFlag(C);
+    auto oldC = lazyCarry();
     REG = (uint8_t)(REG >> 1u) | (uint8_t)(oldC << 7u);
-    SetFlag(Z, IS_ZERO_8(REG));
-    SetFlag(N, false);
-    SetFlag(H, false);
-    SetFlag(C, newC);
+    // Z if the result is zero, N unset, H unset, C set according to the result
+    setFlagsLazy(FLAGS_LOGIC, REG, 0, newC, REG);
     return 2;
 }
 
@@ -965,13 +900,11 @@ int CPU::RR_REG(uint8_t& REG) {
 int CPU::RR_Addr_REG16(const uint16_t& REG) {
     uint8_t byte = READ(REG);
     auto newC = (uint8_t)(byte & 0x01u);
-    auto oldC = GetFlag(C);
+    auto oldC = lazyCarry();
     byte = (uint8_t)(byte >> 1u) | (uint8_t)(oldC << 7u);
     WRITE(REG, byte);
-    SetFlag(Z, IS_ZERO_8(byte));
-    SetFlag(N, false);
-    SetFlag(H, false);
-    SetFlag(C, newC);
+    // Z if the result is zero, N unset, H unset, C set according to the result
+    setFlagsLazy(FLAGS_LOGIC, byte, 0, newC, byte);
     return 4;
 }
 
@@ -984,10 +917,8 @@ int CPU::RR_Addr_REG16(const uint16_t& REG) {
 int CPU::RRC_REG(uint8_t &REG) {
     auto c = (uint8_t)(REG & 0x01u); // either 0x00 or 0x01
     REG = (uint8_t)(REG >> 1u) | (uint8_t)(c << 7u);
-    SetFlag(Z, IS_ZERO_8(REG));
-    SetFlag(N, false);
-    SetFlag(H, false);
-    SetFlag(C, c);
+    // Z if the result is zero, N unset, H unset, C set according to the result
+    setFlagsLazy(FLAGS_LOGIC, REG, 0, c, REG);
     return 2;
 }
 
@@ -1002,10 +933,8 @@ int CPU::RRC_Addr_REG16(const uint16_t &REG) {
     auto c = (uint8_t)(byte & 0x01u); // either 0x00 or 0x01
     byte = (uint8_t)(byte >> 1u) | (uint8_t)(c << 7u);
     WRITE(REG, byte);
-    SetFlag(Z, IS_ZERO_8(byte));
-    SetFlag(N, false);
-    SetFlag(H, false);
-    SetFlag(C, c);
+    // Z if the result is zero, N unset, H unset, C set according to the result
+    setFlagsLazy(FLAGS_LOGIC, byte, 0, c, byte);
     return 4;
 }
 
@@ -1018,14 +947,8 @@ int CPU::RRC_Addr_REG16(const uint16_t &REG) {
 int CPU::SLA_REG(uint8_t& REG) {
     auto c = (uint8_t)(REG >> 7u) & 0x01u; // either 0x00 or 0x01
     REG = (uint8_t)(REG << 1u);
-    // Z set depending on the result
-    SetFlag(Z, IS_ZERO_8(REG));
-    // N unset
-    SetFlag(N, false);
-    // H unset
-    SetFlag(H, false);
-    // C set according to the result
-    SetFlag(C, c);
+    // Z if the result is zero, N unset, H unset, C set according to the result
+    setFlagsLazy(FLAGS_LOGIC, REG, 0, c, REG);
     return 2;
 }
 
@@ -1040,13 +963,8 @@ int CPU::SLA_Addr_REG16(const uint16_t& REG) {
     auto res = (uint8_t)(byte << 1u);
     WRITE(REG, res);
     // Z flag is set depending on the result
-    SetFlag(Z, IS_ZERO_8(res));
-    // N unset
-    SetFlag(N, false);
-    // H unset
-    SetFlag(H, false);
-    // C set according to the result
-    SetFlag(C, c);
+    // Z if the result is zero, N unset, H unset, C set according to the result
+    setFlagsLazy(FLAGS_LOGIC, res, 0, c, res);
     return 4;
 }
 
@@ -1059,14 +977,8 @@ int CPU::SLA_Addr_REG16(const uint16_t& REG) {
 int CPU::SRA_REG(uint8_t& REG) {
     auto c = (uint8_t)(REG & 0x01u); // either 0x00 or 0x01
     REG = (uint8_t)(REG >> 1u) | (uint8_t)(REG & 0x80u); // as per summary we shift the 7th bit back in place
-    // Z set depending on the result
-    SetFlag(Z, IS_ZERO_8(REG));
-    // N unset
-    SetFlag(N, false);
-    // H unset
-    SetFlag(H, false);
-    // C set according to the result
-    SetFlag(C, c);
+    // Z if the result is zero, N unset, H unset, C set according to the result
+    setFlagsLazy(FLAGS_LOGIC, REG, 0, c, REG);
     return 2;
 }
 
@@ -1081,14 +993,8 @@ int CPU::SRA_Addr_REG16(const uint16_t& REG) {
     auto c = (uint8_t)(byte & 0x01u); // either 0x00 or 0x01
     uint8_t res = (uint8_t)(byte >> 1u) | (uint8_t)(byte & 0x80u); // as per summary we shift the 7th bit back in place
     WRITE(REG, res);
-    // Z set depending on the result
-    SetFlag(Z, IS_ZERO_8(res));
-    // N unset
-    SetFlag(N, false);
-    // H unset
-    SetFlag(H, false);
-    // C set according to the result
-    SetFlag(C, c);
+    // Z if the result is zero, N unset, H unset, C set according to the result
+    setFlagsLazy(FLAGS_LOGIC, res, 0, c, res);
     return 4;
 }
 
@@ -1101,14 +1007,8 @@ int CPU::SRA_Addr_REG16(const uint16_t& REG) {
 int CPU::SRL_REG(uint8_t& REG) {
     auto c = (uint8_t)(REG & 0x01u); // either 0x00 or 0x01
     REG = (uint8_t)(REG >> 1u);
-    // Z set depending on the result
-    SetFlag(Z, IS_ZERO_8(REG));
-    // N unset
-    SetFlag(N, false);
-    // H unset
-    SetFlag(H, false);
-    // C set according to the result
-    SetFlag(C, c);
+    // Z if the result is zero, N unset, H unset, C set according to the result
+    setFlagsLazy(FLAGS_LOGIC, REG, 0, c, REG);
     return 2;
 }
 
@@ -1123,14 +1023,8 @@ int CPU::SRL_Addr_REG16(const uint16_t &REG) {
     auto c = (uint8_t)(byte & 0x01u); // either 0x00 or 0x01
     auto res = (uint8_t)(byte >> 1u);
     WRITE(REG, res);
-    // Z set depending on the result
-    SetFlag(Z, IS_ZERO_8(res));
-    // N unset
-    SetFlag(N, false);
-    // H unset
-    SetFlag(H, false);
-    // C set according to the result
-    SetFlag(C, c);
+    // Z if the result is zero, N unset, H unset, C set according to the result
+    setFlagsLazy(FLAGS_LOGIC, res, 0, c, res);
     return 4;
 }
 
@@ -1143,12 +1037,8 @@ int CPU::SWAP_REG(uint8_t& REG) {
     uint8_t upper = REG & 0xF0u;
     uint8_t lower = REG & 0x0Fu;
     REG = (uint8_t)(upper >> 4u) | (uint8_t)(lower << 4u);
-    // Set Z if result is zero
-    SetFlag(Z, IS_ZERO_8(REG));
-    // Rest unset
-    SetFlag(N, false);
-    SetFlag(H, false);
-    SetFlag(C, false);
+    // Z if the result is zero, N unset, H unset, C unset
+    setFlagsLazy(FLAGS_LOGIC, REG, 0, 0, REG);
     return 2;
 }
 
@@ -1163,17 +1053,13 @@ int CPU::SWAP_Addr_REG16(const uint16_t &REG) {
     uint8_t lower = byte & 0x0Fu;
     uint8_t res = (uint8_t)(upper >> 4u) | (uint8_t)(lower << 4u);
     WRITE(REG, res);
-    // Set Z if result is zero
-    SetFlag(Z, IS_ZERO_8(res));
-    // Rest unset
-    SetFlag(N, false);
-    SetFlag(H, false);
-    SetFlag(C, false);
+    // Z if the result is zero, N unset, H unset, C unset
+    setFlagsLazy(FLAGS_LOGIC, res, 0, 0, res);
     return 4;
 }
 
 
-int CPU::stepCPU() {
+int CPU::stepSwitch() {
     switch (READ(regs.pc++)) {
         /* First Row */
         case 0x00:
@@ -2232,141 +2118,174 @@ int CPU::stepCPU() {
     }
 }
 
+// C++14 still needs out-of-line definitions for odr-used constexpr static members
+constexpr CPU::INSTRUCTION CPU::OpcodeTable::lookup[256];
+constexpr CPU::INSTRUCTION CPU::OpcodeTable::lookupCB[256];
+constexpr int (*CPU::OpcodeTable::decoded[256])(CPU&, uint16_t);
+constexpr int (*CPU::OpcodeTable::decodedCB[256])(CPU&, uint16_t);
+constexpr const char* CPU::OpcodeTable::names[256];
+constexpr const char* CPU::OpcodeTable::namesCB[256];
+
+const char* CPU::mnemonic(uint8_t opcode, uint8_t cbOpcode) {
+    return opcode == PREFIX ? OpcodeTable::namesCB[cbOpcode] : OpcodeTable::names[opcode];
+}
+
+bool CPU::parseDispatch(const std::string& name, DISPATCH_MODE& mode) {
+    if (name == "switch") mode = DISPATCH_SWITCH;
+    else if (name == "table") mode = DISPATCH_TABLE;
+    else if (name == "block") mode = DISPATCH_BLOCK;
+#if GB_THREADED
+    else if (name == "threaded") mode = DISPATCH_THREADED;
+#endif
+#if GB_JIT
+    else if (name == "jit") mode = DISPATCH_JIT;
+#endif
+    else return false;
+    return true;
+}
+
+int CPU::stepCPU() {
+#if GB_PROFILE
+    uint16_t pc = regs.pc;
+    uint8_t opcode = READ(pc);
+    bool prefixed = opcode == PREFIX;
+    if (prefixed) opcode = READ((uint16_t) (pc + 1));
+    uint64_t start = Profiler::now();
+    int cycles = dispatchMode == DISPATCH_SWITCH ? stepSwitch() : stepTable();
+    profiler.record(pc, prefixed, opcode, Profiler::now() - start);
+    return cycles;
+#else
+    if (dispatchMode == DISPATCH_SWITCH) return stepSwitch();
+    return stepTable();
+#endif
+}
+
+#if GB_PROFILE
+void CPU::printProfile(FILE* out) const {
+    profiler.report(out, OpcodeTable::names, OpcodeTable::namesCB);
+}
+#endif
+
+int CPU::execute(int budget) {
+    int spent;
+    runCycles = 0;
+    if (dispatchMode == DISPATCH_BLOCK) {
+        spent = runBlocks(interrupts_cycles_left_to_enabled != 0 ? 1 : budget);
+#if GB_JIT
+    } else if (dispatchMode == DISPATCH_JIT) {
+        spent = runJit(budget);
+#endif
+#if GB_THREADED
+    } else if (dispatchMode == DISPATCH_THREADED) {
+        // NOTE: the EI delay ends with a scheduled event, so single-step while it is pending
+        spent = runThreaded(interrupts_cycles_left_to_enabled != 0 ? 1 : budget);
+#endif
+    } else {
+        spent = stepCPU();
+        retired++;
+    }
+    runCycles = 0;
+    return spent;
+}
+
+#if GB_THREADED
 /**
- * The Gameboy subsystem is composed by three timer REGS (TIMA, TMA, TAC)
- * and the DIV REG (0xFF04).
- * The DIV REG workds by using an internal system 16-bit counter. This counter increases
- * each clock (4-clocks per NOP). DIV is the upper 8-bits of the counter.
- * Thus, it increases every 256 oscillator clocks.
- * TAC (oxFF07) is the Timer Control Register.
- * This register enables/disables the timer and sets its frequency.
- * Bit 2: Timer enable.
- * Bit 1-0: Main frequency divider
- * TIMA (0xFF05) is the Timer Counter REG.
- * This REG holds an 8-bit value that is the timer counter. It increases at a certain freq until
- * it overflows. When this occurs, the value in TMA is loaded into TIMA and a TIMER interrupt is
- * requested if the corresponding IE flag is set and IME is set.
- * TMA (0xff06) if the Timer Modulo REG. The 8-bit value this reg stores is loaded into TIMA when
- * TIMA overflows
+ * Direct-threaded core (GCC/Clang labels-as-values).
+ * Every handler body from Opcodes.inc gets its own label and jumps straight to the next one,
+ * so the only way out of the loop is the budget running out or runBreak being raised.
  */
-void CPU::handleCycles(int c) {
-    // TODO make sure this method is correct
-    // set DIV REG
-    div_clocksum += c; // QUESTION why not multiplied by 4?
-    if (div_clocksum >= 256) {
-        div_clocksum -= 256;
-        // DONE increase DIV REG
-        WRITE(DIV, READ(DIV) + 1);
-    }
+int CPU::runThreaded(int budget) {
+    // 0xCB threads straight into the prefixed labels instead of the PREFIX_CB table call
+    // NOTE: constant tables, so any number of CPUs can run this on different threads
+    static void* const labels[256] = {
+#define OP(code, length, cycles, name, expr) (code) == PREFIX ? &&L_PREFIX : &&L_##code,
+#include "Opcodes.inc"
+#undef OP
+    };
+    static void* const labelsCB[256] = {
+#define CB_OP(code, length, cycles, name, expr) &&CB_L_##code,
+#include "Opcodes.inc"
+#undef CB_OP
+    };
+
+    int spent = 0;
+    runBreak = false;
+
+#define DISPATCH() do { if (spent >= budget || runBreak) return spent; runCycles = spent; retired++; goto *labels[READ(regs.pc++)]; } while (0)
+    DISPATCH();
+L_PREFIX:
+    goto *labelsCB[READ(regs.pc++)];
+#define OP(code, length, cycles, name, expr) L_##code: spent += expr; DISPATCH();
+#define CB_OP(code, length, cycles, name, expr) CB_L_##code: spent += expr; DISPATCH();
+#include "Opcodes.inc"
+#undef OP
+#undef CB_OP
+#undef DISPATCH
+}
+#endif
 
-    // check TAC to see if the timer is enabled
-    // RECALL bit 2 is the enable TIMER bit for TAC
-    if ((READ(TAC) >> 2u) & 0x01u) {
-        // increase counter
-        cycles += c * 4;
-
-        // timer gets incremented at a defined rate, which we set
-        // set frequency for timer
-        // NOTE different than CPU frequency which is 4194304Hz
-        /*
-         * For bits 1-0 of the TAC:
-         * 00: 4096Hz
-         * 01 262144Hz
-         * 10: 65536Hz
-         * 11: 16386Hz
-         */
-        int freq = 4096;
-        if ((READ(TAC) & 0x3u) == 0x01u) {
-            freq = 262144;
-        } else if ((READ(TAC) & 0x3u) == 0x02u) {
-            freq = 65536;
-        } else if ((READ(TAC) & 0x03u) == 0x03u) {
-            freq = 16386;
-        }
-
-
-        // Since the timer increments at a defined frequency which is less
-        // than the CPU, we "catch-up" the timer to the number of clock cycles 
-        // in this way:
-
-        while (cycles >= (CPU_FREQ / freq)) {
-            // increase TIMA
-            WRITE(TIMA, READ(TIMA) + 1);
-
-            // check for TIMA overflow
-            if (READ(TIMA) == 0x00) {
-                // set timer interrupt request (recall this sets the fourth bit to 1 of IF)
-                WRITE(INTERRUPT_FLAG_REG, READ(INTERRUPT_FLAG_REG) | TIMER_RQ);
-                // write TMA to TIMA
-                WRITE(TIMA, READ(TMA));
-            }
-            cycles -= (CPU_FREQ / freq);
-        }
-    }
+/**
+ * Table driven core: one indexed load and an indirect call per opcode.
+ * Behaves exactly like stepSwitch since both are generated from the same mappings.
+ */
+int CPU::stepTable() {
+    return OpcodeTable::lookup[READ(regs.pc++)].operate(*this);
 }
 
-void CPU::handleInterrupts() {
-    // NOTE This is for keeping track of how many cycles after EI occurs where interrupts are enabled
-    if (interrupts_cycles_left_to_enabled != 0 && --interrupts_cycles_left_to_enabled == 0) {
-        interrupts_enabled = true;
-    }
-    if (interrupts_enabled) {
-        if (READ(INTERRUPT_FLAG_REG) & READ(INTERRUPT_ENABLE_REG)) {
-            // NOTE: Interrupts are written in order of their priority
-            // RECALL: AND is associative
-
-            // VBLANK Interrupt
-            if ((READ(INTERRUPT_FLAG_REG) & VBLANK_RQ) & (READ(INTERRUPT_ENABLE_REG) & VBLANK_RQ)) {
-                // push the PC to stack
-                pushToStack(regs.pc);
-                // jump to the appropriate Interrupt vector
-                regs.pc = VBLANK;
-                // "Turn off" the interrupt -> says we have handled it
-                WRITE(INTERRUPT_FLAG_REG, READ(INTERRUPT_FLAG_REG) & ~(VBLANK_RQ));
-            }
+CPU::OPCODE CPU::PREFIX_CB() {
+    return OpcodeTable::lookupCB[READ(regs.pc++)].operate(*this);
+}
 
-            // LCD STAT Interrupt
-            if ((READ(INTERRUPT_FLAG_REG) & LCD_STAT_RQ) & (READ(INTERRUPT_ENABLE_REG) & LCD_STAT_RQ)) {
-                // push the PC to stack
-                pushToStack(regs.pc);
-                // jump to the appropriate Interrupt vector
-                regs.pc = LCD_STAT;
-                // "Turn off" the interrupt -> says we have handled it
-                WRITE(INTERRUPT_FLAG_REG, READ(INTERRUPT_FLAG_REG) & ~(LCD_STAT_RQ));
-            }
+CPU::OPCODE CPU::ILLEGAL() {
+    printf("Unsupported OPCODE 0x%02x at 0x%04x", READ(regs.pc - 1), regs.pc - 1);
+    std::exit(EXIT_FAILURE);
+}
 
-            // TIMER Interrupt
-            if ((READ(INTERRUPT_FLAG_REG) & TIMER_RQ) & (READ(INTERRUPT_ENABLE_REG) & TIMER_RQ)) {
-                // push the PC to stack
-                pushToStack(regs.pc);
-                // jump to the appropriate Interrupt vector
-                regs.pc = TIMER;
-                // "Turn off" the interrupt -> says we have handled it
-                WRITE(INTERRUPT_FLAG_REG, READ(INTERRUPT_FLAG_REG) & ~(TIMER_RQ));
-            }
+// per-opcode handlers used by the tables
+#define OP(code, length, cycles, name, expr) CPU::OPCODE CPU::OP_##code() { return expr; }
+#define CB_OP(code, length, cycles, name, expr) CPU::OPCODE CPU::CB_##code() { return expr; }
+#include "Opcodes.inc"
+#undef OP
+#undef CB_OP
 
-            // Serial Interrupt
-            if ((READ(INTERRUPT_FLAG_REG) & SERIAL_RQ) & (READ(INTERRUPT_ENABLE_REG) & SERIAL_RQ)) {
-                // push the PC to stack
-                pushToStack(regs.pc);
-                // jump to the appropriate Interrupt vector
-                regs.pc = SERIAL;
-                // "Turn off" the interrupt -> says we have handled it
-                WRITE(INTERRUPT_FLAG_REG, READ(INTERRUPT_FLAG_REG) & ~(SERIAL_RQ));
-            }
+namespace {
+// index of the lowest set bit of a 5-bit interrupt mask (the highest priority request)
+constexpr uint8_t lowestInterrupt[32] = {
+        0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+        4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+};
+} // namespace
 
-            // Joy-pad Interrupt
-            if ((READ(INTERRUPT_FLAG_REG) & JOYPAD_RQ) & (READ(INTERRUPT_ENABLE_REG) & JOYPAD_RQ)) {
-                // push the PC to stack
-                pushToStack(regs.pc);
-                // jump to the appropriate Interrupt vector
-                regs.pc = JOYPAD;
-                // "Turn off" the interrupt -> says we have handled it
-                WRITE(INTERRUPT_FLAG_REG, READ(INTERRUPT_FLAG_REG) & ~(JOYPAD_RQ));
-            }
+/**
+ * Dispatch the highest priority pending interrupt (VBLANK, LCD STAT, TIMER, SERIAL, JOYPAD):
+ * IME is cleared, its IF bit acknowledged, and PC pushed before jumping to its vector (0x40 + 8 * bit).
+ * The Bus only calls this when IME is set and IE & IF is non zero.
+ */
+void CPU::handleInterrupts() {
+    // NOTE: the EI delay is handled by the Bus scheduler (Scheduler::EVENT_EI)
+    uint8_t pending = bus->pendingInterrupts();
+    if (!interrupts_enabled || !pending) return;
+    unsigned bit = lowestInterrupt[pending];
+    interrupts_enabled = false;
+    bus->acknowledgeInterrupt((uint8_t) (1u << bit));
+    // push the PC to stack
+    pushToStack(regs.pc);
+    // jump to the appropriate Interrupt vector
+    regs.pc = VBLANK + 8u * bit;
+}
 
-        }
-    }
+CPU::State CPU::state() {
+    flushFlags();
+    return State{regs, interrupts_cycles_left_to_enabled, HALT_FLAG, unpaused, interrupts_enabled};
+}
+
+void CPU::restore(const State& s) {
+    regs = s.regs;
+    lazyFlags = LAZY_FLAGS();
+    interrupts_cycles_left_to_enabled = s.eiDelay;
+    HALT_FLAG = s.halted;
+    unpaused = s.unpaused;
+    interrupts_enabled = s.ime;
 }
 
 /* DONE: Complete OPCODES */
@@ -2404,11 +2323,7 @@ CPU::OPCODE CPU::INC_BC()
 // Z affected, N unset, H affected
 CPU::OPCODE CPU::INC_B()
 {
-    auto b = regs.bc.B;
-    regs.bc.B++;
-    SetFlag(Z, IS_ZERO_8(regs.bc.B));
-    SetFlag(N, false);
-    SetFlag(H, HAS_HALF_CARRY_8(b, 0x01u));
+    INCREMENT_8_BIT_REG(regs.bc.B);
     return 1;
 }
 
@@ -2417,10 +2332,7 @@ CPU::OPCODE CPU::INC_B()
 // NOTE: I have to check again whether this is what they mean with the Half carry condition
 CPU::OPCODE CPU::DEC_B()
 {
-    regs.bc.B--;
-    SetFlag(Z, IS_ZERO_8(regs.bc.B));
-    SetFlag(N, true);
-    SetFlag(H, HAS_HALF_CARRY_DECREMENT_8(regs.bc.B));
+    DECREMENT_8_BIT_REG(regs.bc.B);
     return 1;
 }
 
@@ -2484,11 +2396,7 @@ CPU::OPCODE CPU::DEC_BC() {
 
 // Increment register C
 CPU::OPCODE CPU::INC_C() {
-    uint8_t n = regs.bc.C;
-    regs.bc.C++;
-    SetFlag(Z, IS_ZERO_8(regs.bc.C));
-    SetFlag(N, false);
-    SetFlag(H, HAS_HALF_CARRY_8(n, 0x01u));
+    INCREMENT_8_BIT_REG(regs.bc.C);
     return 1;
 }
 
@@ -2496,10 +2404,7 @@ CPU::OPCODE CPU::INC_C() {
 // Z affected, N set, H affected
 // NOTE: I have to check again whether this is what they mean with the Half carry condition
 CPU::OPCODE CPU::DEC_C() {
-    regs.bc.C--;
-    SetFlag(Z, IS_ZERO_8(regs.bc.C));
-    SetFlag(N, true);
-    SetFlag(H, HAS_HALF_CARRY_DECREMENT_8(regs.bc.C));
+    DECREMENT_8_BIT_REG(regs.bc.C);
     return 1;
 }
 
@@ -2525,6 +2430,7 @@ CPU::OPCODE CPU::RRCA() {
 // NOTE: I may not need this anyways
 CPU::OPCODE CPU::STOP() {
     HALT_FLAG = true;
+    runBreak = true;
     return 1;
 }
 
@@ -2549,21 +2455,14 @@ CPU::OPCODE CPU::INC_DE() {
 // Increment register D
 // Z is affected, N is unset, H is affected
 CPU::OPCODE CPU::INC_D() {
-    uint8_t d = regs.de.D;
-    regs.de.D++;
-    SetFlag(Z, IS_ZERO_8(regs.de.D));
-    SetFlag(N, false);
-    SetFlag(H, HAS_HALF_CARRY_8(d, 0x01u));
+    INCREMENT_8_BIT_REG(regs.de.D);
     return 1;
 }
 
 // Decrement the register D
 // Z is affected, N is set, H is affected
 CPU::OPCODE CPU::DEC_D() {
-    regs.de.D--;
-    SetFlag(Z, IS_ZERO_8(regs.de.D));
-    SetFlag(N, true);
-    SetFlag(H, HAS_HALF_CARRY_DECREMENT_8(regs.de.D));
+    DECREMENT_8_BIT_REG(regs.de.D);
     return 1;
 }
 
@@ -2622,11 +2521,7 @@ CPU::OPCODE CPU::DEC_DE() {
 // Increment register E
 // Z affected, N unset, H affected
 CPU::OPCODE CPU::INC_E() {
-    auto e = regs.de.E;
-    regs.de.E++;
-    SetFlag(Z, IS_ZERO_8(regs.de.E));
-    SetFlag(N, false);
-    SetFlag(H, HAS_HALF_CARRY_8(e, 0x01u));
+    INCREMENT_8_BIT_REG(regs.de.E);
     return 1;
 }
 
@@ -2634,10 +2529,7 @@ CPU::OPCODE CPU::INC_E() {
 // Z affected, N set, H affected
 // NOTE: I have to check again whether this is what they mean with the Half carry condition
 CPU::OPCODE CPU::DEC_E() {
-    regs.de.E--;
-    SetFlag(Z, IS_ZERO_8(regs.de.E));
-    SetFlag(N, true);
-    SetFlag(H, HAS_HALF_CARRY_DECREMENT_8(regs.de.E));
+    DECREMENT_8_BIT_REG(regs.de.E);
     return 1;
 }
 
@@ -2694,12 +2586,8 @@ CPU::OPCODE CPU::INC_HL() {
 // Increment register H
 // z affected, N unset, H affected
 CPU::OPCODE CPU::INC_H() {
-  auto h = regs.hl.H;
-  regs.hl.H++;
-  SetFlag(Z, IS_ZERO_8(regs.hl.H));
-  SetFlag(N, false);
-  SetFlag(H, HAS_HALF_CARRY_8(h, 0x01u));
-  return 1;
+    INCREMENT_8_BIT_REG(regs.hl.H);
+    return 1;
 }
 
 // Decrement register H
@@ -3248,6 +3136,7 @@ CPU::OPCODE CPU::LD_Addr_HL_L() {
  */
 CPU::OPCODE CPU::HALT() {
     HALT_FLAG = true;
+    runBreak = true;
     return 1;
 }
 
@@ -3991,21 +3880,19 @@ CPU::OPCODE CPU::LD_A_FF00_n(uint8_t n) {
 
 // Pop reg AF from the stack
 // 3 cycles
-// NOTE: slightly different from the standard CPU::popFromStack
+// NOTE: like POP_REG, except that the low 4 bits of F always read back as 0
 // Flags affected:
 // Z: Set from bit 7 of the popped low byte
 // N: Set from bit 6 of the popped low byte
 // H: Set from bit 5 of the popped low byte
 // C: Set from bit 4 of the popped low byte
 CPU::OPCODE CPU::POP_AF() {
-    uint8_t hi = READ(++regs.sp);
-    uint8_t lo = READ(++regs.sp);
-    // NOTE: Recall last 4 bits of F are unused
-    regs.af.AF = (uint16_t)(((uint8_t)(hi << 8u) | lo) & 0xFFF0u);
-    SetFlag(Z, lo & 0x80u); // 0b10000000
-    SetFlag(N, lo & 0x40u); // 0b01000000
-    SetFlag(H, lo & 0x20u); // 0b00100000
-    SetFlag(C, lo & 0x10u); // 0b00100000
+    uint8_t lo = READ(regs.sp++);
+    uint8_t hi = READ(regs.sp++);
+    // F is overwritten below, whatever ALU result was pending is dead
+    lazyFlags.op = FLAGS_CLEAN;
+    // NOTE: Recall last 4 bits of F are unused; Z/N/H/C come straight from bits 7-4 of the low byte
+    regs.af.AF = (uint16_t)(((uint16_t)(hi << 8u) | lo) & 0xFFF0u);
     return 3;
 }
 
@@ -4037,6 +3924,7 @@ CPU::OPCODE CPU::DI() {
 // NOTE: Recall that AF=A3A2A1A0ZNHCXXXX
 // Where X=unused
 CPU::OPCODE CPU::PUSH_AF() {
+    flushFlags();
     return PUSH_REG(regs.af.AF);
 }
 
@@ -4099,6 +3987,7 @@ CPU::OPCODE CPU::EI() {
      * ld   [hl+],a
      */
     interrupts_cycles_left_to_enabled = 2;
+    runBreak = true;
     return 1;
 }
 
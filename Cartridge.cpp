@@ -0,0 +1,384 @@
+//
+// Cartridge ROM/RAM and memory bank controllers (see Cartridge.h).
+//
+
+#include "Cartridge.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Header fields
+#define HEADER_TYPE 0x0147u
+#define HEADER_RAM_SIZE 0x0149u
+
+// Clock cycles per RTC second
+#define RTC_CLOCKS 4194304ull
+#define SECONDS_PER_DAY 86400ull
+
+namespace {
+
+// External RAM sizes for header byte 0x0149
+const size_t RAM_SIZES[6] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+
+Cartridge::MBC mbcFor(uint8_t type, bool& known) {
+    known = true;
+    switch (type) {
+        case 0x00: case 0x08: case 0x09:
+            return Cartridge::MBC_NONE;
+        case 0x01: case 0x02: case 0x03:
+            return Cartridge::MBC_1;
+        case 0x05: case 0x06:
+            return Cartridge::MBC_2;
+        case 0x0F: case 0x10: case 0x11: case 0x12: case 0x13:
+            return Cartridge::MBC_3;
+        case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E:
+            return Cartridge::MBC_5;
+        default:
+            known = false;
+            return Cartridge::MBC_NONE;
+    }
+}
+
+bool hasBattery(uint8_t type) {
+    switch (type) {
+        case 0x03: case 0x06: case 0x09: case 0x0F: case 0x10: case 0x13: case 0x1B: case 0x1E:
+            return true;
+        default:
+            return false;
+    }
+}
+
+const char* mbcName(Cartridge::MBC mbc) {
+    static const char* names[] = {"ROM only", "MBC1", "MBC2", "MBC3", "MBC5"};
+    return names[mbc];
+}
+
+} // namespace
+
+Cartridge::~Cartridge() {
+    unload();
+}
+
+void Cartridge::unload() {
+    if (mappedSize) munmap(const_cast<uint8_t*>(rom), mappedSize);
+    rom = nullptr;
+    mappedSize = 0;
+    romCopy.clear();
+    romBanks = 0;
+    // a shared mapping needs no final write, its pages are already the file's
+    if (ramMapped) munmap(ramData, ramMapped);
+    ramData = nullptr;
+    ramLength = 0;
+    ramMapped = 0;
+    ramCopy.clear();
+    ramDirty = false;
+}
+
+bool Cartridge::mapSaveFile(const std::string& path, size_t length) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    struct stat st{};
+    // a longer file is left alone (some emulators append the RTC state)
+    bool sized = fstat(fd, &st) == 0 && ((size_t) st.st_size >= length || ftruncate(fd, (off_t) length) == 0);
+    void* map = sized ? mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    ramData = static_cast<uint8_t*>(map);
+    ramMapped = length;
+    return true;
+}
+
+void Cartridge::flush() {
+    if (!ramMapped || !ramDirty) return;
+    msync(ramData, ramMapped, MS_ASYNC);
+    ramDirty = ramEnabled;
+}
+
+bool Cartridge::load(const std::string& path, bool persistRam) {
+    unload();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size <= (off_t) HEADER_RAM_SIZE) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t) st.st_size;
+
+    if (size >= 2 * ROM_BANK_SIZE && size % ROM_BANK_SIZE == 0) {
+        void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            rom = static_cast<const uint8_t*>(map);
+            mappedSize = size;
+            romBanks = size / ROM_BANK_SIZE;
+        }
+    }
+    if (!rom) {
+        // a partial bank would leave page pointers past the end of the mapping: copy and pad with 0xFF
+        romBanks = std::max<size_t>(2, (size + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE);
+        romCopy.assign(romBanks * ROM_BANK_SIZE, 0xFF);
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = pread(fd, romCopy.data() + done, size - done, (off_t) done);
+            if (n <= 0) break;
+            done += (size_t) n;
+        }
+        if (done != size) {
+            close(fd);
+            unload();
+            return false;
+        }
+        rom = romCopy.data();
+    }
+    close(fd);
+
+    bool known;
+    type = mbcFor(rom[HEADER_TYPE], known);
+    if (!known) {
+        std::cerr << "Warning: unsupported cartridge type 0x" << std::hex << (int) rom[HEADER_TYPE] << std::dec
+                  << ", running it as ROM only." << std::endl;
+    }
+    uint8_t ramCode = rom[HEADER_RAM_SIZE];
+    size_t ramBytes = type == MBC_2 ? 0x200 : ramCode < 6 ? RAM_SIZES[ramCode] : 0;
+    ramLength = ramBytes;
+    if (ramBytes && persistRam && hasBattery(rom[HEADER_TYPE])) {
+        size_t dot = path.find_last_of('.'), slash = path.find_last_of('/');
+        bool extension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+        std::string savePath = (extension ? path.substr(0, dot) : path) + ".sav";
+        if (!mapSaveFile(savePath, ramBytes)) {
+            std::cerr << "Warning: could not map save file " << savePath << ", battery RAM won't be kept."
+                      << std::endl;
+        }
+    }
+    if (!ramMapped) {
+        ramCopy.assign(ramBytes, 0);
+        ramData = ramCopy.data();
+    }
+
+    ramEnabled = type == MBC_NONE;
+    bankLow = 1;
+    bankHigh = 0;
+    mode1 = false;
+    rtcSeconds = 0;
+    rtcSynced = 0;
+    rtcHalted = false;
+    rtcCarry = false;
+    rtcLatch = 0xFF;
+    std::fill(rtcLatched, rtcLatched + 5, 0);
+
+    return true;
+}
+
+std::string Cartridge::describe() const {
+    std::ostringstream out;
+    out << romSize() / 1024 << "KB ROM (" << mbcName(type) << ", " << romBanks << " banks, " << ramLength / 1024
+        << "KB RAM" << (ramMapped ? ", battery" : "") << ")" << (mappedSize ? "" : " in memory");
+    return out.str();
+}
+
+unsigned Cartridge::romBank0() const {
+    // MBC1 mode 1 banks the upper bits into the low area as well
+    unsigned bank = type == MBC_1 && mode1 ? (bankHigh & 3u) << 5u : 0;
+    return bank % romBanks;
+}
+
+unsigned Cartridge::romBankX() const {
+    unsigned bank;
+    switch (type) {
+        case MBC_NONE:
+            bank = 1;
+            break;
+        case MBC_1:
+            // the zero check only looks at the 5 low bits (bank 0x20 reads as 0x21...)
+            bank = (bankLow & 0x1Fu ? bankLow & 0x1Fu : 1u) | (bankHigh & 3u) << 5u;
+            break;
+        case MBC_2:
+            bank = bankLow & 0x0Fu ? bankLow & 0x0Fu : 1u;
+            break;
+        case MBC_3:
+            bank = bankLow & 0x7Fu ? bankLow & 0x7Fu : 1u;
+            break;
+        default:
+            bank = bankLow & 0x1FFu;
+            break;
+    }
+    return bank % romBanks;
+}
+
+unsigned Cartridge::ramBank() const {
+    size_t banks = ramLength / RAM_BANK_SIZE;
+    if (banks == 0) return 0;
+    switch (type) {
+        case MBC_1: return mode1 ? (bankHigh & 3u) % banks : 0;
+        case MBC_3: return (bankHigh & 3u) % banks;
+        case MBC_5: return (bankHigh & 0x0Fu) % banks;
+        default: return 0;
+    }
+}
+
+const uint8_t* Cartridge::romPage(uint16_t addr) const {
+    unsigned bank = addr < 0x4000u ? romBank0() : romBankX();
+    return rom + bank * ROM_BANK_SIZE + (addr & 0x3F00u);
+}
+
+uint8_t* Cartridge::ramPage(uint16_t addr) {
+    // MBC2 RAM only has the low nibbles, and a 2KB RAM covers part of the window only
+    if (!ramEnabled || type == MBC_2 || rtcSelected() || ramLength < RAM_BANK_SIZE) return nullptr;
+    return ramData + ramBank() * RAM_BANK_SIZE + (addr & 0x1F00u);
+}
+
+uint8_t Cartridge::write(uint16_t addr, uint8_t data, uint64_t now) {
+    unsigned rom0 = romBank0(), romX = romBankX(), ramIndex = ramBank();
+    bool ramWasDirect = ramPage(0xA000u) != nullptr, wasEnabled = ramEnabled;
+    switch (type) {
+        case MBC_NONE:
+            return 0;
+        case MBC_1:
+            if (addr < 0x2000u) ramEnabled = (data & 0x0Fu) == 0x0Au;
+            else if (addr < 0x4000u) bankLow = data & 0x1Fu;
+            else if (addr < 0x6000u) bankHigh = data & 0x03u;
+            else mode1 = (data & 1u) != 0;
+            break;
+        case MBC_2:
+            // address bit 8 tells the two registers apart
+            if (addr >= 0x4000u) return 0;
+            if (addr & 0x100u) bankLow = data & 0x0Fu;
+            else ramEnabled = (data & 0x0Fu) == 0x0Au;
+            break;
+        case MBC_3:
+            if (addr < 0x2000u) ramEnabled = (data & 0x0Fu) == 0x0Au;
+            else if (addr < 0x4000u) bankLow = data & 0x7Fu;
+            else if (addr < 0x6000u) bankHigh = data & 0x0Fu;
+            else {
+                if (rtcLatch == 0x00u && data == 0x01u) {
+                    rtcCatchUp(now);
+                    uint64_t days = rtcSeconds / SECONDS_PER_DAY;
+                    rtcLatched[0] = (uint8_t) (rtcSeconds % 60);
+                    rtcLatched[1] = (uint8_t) (rtcSeconds / 60 % 60);
+                    rtcLatched[2] = (uint8_t) (rtcSeconds / 3600 % 24);
+                    rtcLatched[3] = (uint8_t) days;
+                    rtcLatched[4] = (uint8_t) (((days >> 8u) & 1u) | (rtcHalted ? 0x40u : 0u) |
+                                               (rtcCarry ? 0x80u : 0u));
+                }
+                rtcLatch = data;
+            }
+            break;
+        case MBC_5:
+            if (addr < 0x2000u) ramEnabled = (data & 0x0Fu) == 0x0Au;
+            else if (addr < 0x3000u) bankLow = (bankLow & 0x100u) | data;
+            else if (addr < 0x4000u) bankLow = (bankLow & 0xFFu) | (data & 1u) << 8u;
+            else if (addr < 0x6000u) bankHigh = data & 0x0Fu;
+            break;
+    }
+    if (ramEnabled != wasEnabled) {
+        // a game done saving switches the RAM off: time to get it to the disk
+        if (ramEnabled) ramDirty = true;
+        else flush();
+    }
+    uint8_t remap = 0;
+    if (romBank0() != rom0) remap |= REMAP_ROM0;
+    if (romBankX() != romX) remap |= REMAP_ROMX;
+    if (ramBank() != ramIndex || (ramPage(0xA000u) != nullptr) != ramWasDirect) remap |= REMAP_RAM;
+    return remap;
+}
+
+uint8_t Cartridge::readRam(uint16_t addr, uint64_t now) {
+    if (!ramEnabled) return 0xFF;
+    if (type == MBC_2) return (uint8_t) (0xF0u | ramData[addr & 0x1FFu]);
+    if (rtcSelected()) {
+        rtcCatchUp(now);
+        return rtcRead();
+    }
+    size_t offset = ramBank() * RAM_BANK_SIZE + (addr & 0x1FFFu);
+    return offset < ramLength ? ramData[offset] : 0xFF;
+}
+
+void Cartridge::writeRam(uint16_t addr, uint8_t data, uint64_t now) {
+    if (!ramEnabled) return;
+    if (type == MBC_2) {
+        ramData[addr & 0x1FFu] = data & 0x0Fu;
+        return;
+    }
+    if (rtcSelected()) {
+        rtcCatchUp(now);
+        rtcWrite(data);
+        // writing the seconds also restarts the current second
+        if (bankHigh == 0x08u) rtcSynced = now;
+        return;
+    }
+    size_t offset = ramBank() * RAM_BANK_SIZE + (addr & 0x1FFFu);
+    if (offset < ramLength) ramData[offset] = data;
+}
+
+void Cartridge::rtcCatchUp(uint64_t now) {
+    if (rtcHalted || now <= rtcSynced) {
+        rtcSynced = std::max(rtcSynced, now);
+        return;
+    }
+    uint64_t seconds = (now - rtcSynced) / RTC_CLOCKS;
+    rtcSeconds += seconds;
+    rtcSynced += seconds * RTC_CLOCKS;
+    // the day counter has 9 bits, overflowing it sets the carry until cleared by a write
+    if (rtcSeconds >= 512 * SECONDS_PER_DAY) {
+        rtcSeconds %= 512 * SECONDS_PER_DAY;
+        rtcCarry = true;
+    }
+}
+
+uint8_t Cartridge::rtcRead() const {
+    return rtcLatched[std::min(bankHigh - 0x08u, 4u)];
+}
+
+void Cartridge::rtcWrite(uint8_t data) {
+    uint64_t days = rtcSeconds / SECONDS_PER_DAY;
+    uint64_t s = rtcSeconds % 60, m = rtcSeconds / 60 % 60, h = rtcSeconds / 3600 % 24;
+    switch (bankHigh) {
+        case 0x08: s = data % 60; break;
+        case 0x09: m = data % 60; break;
+        case 0x0A: h = data % 24; break;
+        case 0x0B: days = (days & 0x100u) | data; break;
+        default:
+            days = (days & 0xFFu) | (data & 1u) << 8u;
+            rtcHalted = (data & 0x40u) != 0;
+            rtcCarry = (data & 0x80u) != 0;
+            break;
+    }
+    rtcSeconds = days * SECONDS_PER_DAY + h * 3600 + m * 60 + s;
+    if (bankHigh <= 0x0Cu) rtcLatched[bankHigh - 0x08u] = data;
+}
+
+Cartridge::State Cartridge::state() const {
+    State s{};
+    s.rtcSeconds = rtcSeconds;
+    s.rtcSynced = rtcSynced;
+    s.bankLow = bankLow;
+    s.bankHigh = bankHigh;
+    std::copy(rtcLatched, rtcLatched + 5, s.rtcLatched);
+    s.rtcLatch = rtcLatch;
+    s.ramEnabled = ramEnabled;
+    s.mode1 = mode1;
+    s.rtcHalted = rtcHalted;
+    s.rtcCarry = rtcCarry;
+    return s;
+}
+
+void Cartridge::restore(const State& s, const uint8_t* ram) {
+    rtcSeconds = s.rtcSeconds;
+    rtcSynced = s.rtcSynced;
+    bankLow = s.bankLow;
+    bankHigh = s.bankHigh;
+    std::copy(s.rtcLatched, s.rtcLatched + 5, rtcLatched);
+    rtcLatch = s.rtcLatch;
+    ramEnabled = s.ramEnabled;
+    mode1 = s.mode1;
+    rtcHalted = s.rtcHalted;
+    rtcCarry = s.rtcCarry;
+    // lands in the save file too, like anything the game writes
+    std::copy(ram, ram + ramLength, ramData);
+    ramDirty = true;
+}
@@ -0,0 +1,149 @@
+//
+// Cartridge ROM/RAM and the memory bank controllers in front of them (see Bus::mapPages).
+//
+
+#ifndef NESEMULATOR_CARTRIDGE_H
+#define NESEMULATOR_CARTRIDGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * The ROM file is mmap'd read-only and shared, so any number of emulator instances running the
+ * same ROM share one copy of it in the page cache, and a bank switch only changes which part of
+ * the mapping the Bus page tables point at. (ROMs whose size isn't a whole number of 16KB banks
+ * are copied into a padded buffer instead.)
+ *
+ * The header picks the controller (0x0147), the ROM size (0x0148) and the external RAM size (0x0149):
+ *   ROM only (+RAM): no banking, 32KB of ROM and up to 8KB of RAM
+ *   MBC1: up to 2MB ROM / 32KB RAM; 0x4000-0x5FFF selects the RAM bank or the upper ROM bank bits
+ *         depending on the mode (0x6000-0x7FFF), mode 1 also banks 0x0000-0x3FFF
+ *   MBC2: up to 256KB ROM and 512 x 4 bits of built-in RAM (mirrored over 0xA000-0xBFFF)
+ *   MBC3: up to 2MB ROM / 32KB RAM plus the real time clock registers (0x08-0x0C in the RAM bank)
+ *   MBC5: up to 8MB ROM (9 bit bank number, bank 0 can be mapped at 0x4000) / 128KB RAM
+ *
+ * Bank numbers wrap around the banks the cartridge has. The RTC counts emulated time (clock cycles,
+ * see Bus::now), so runs stay deterministic.
+ *
+ * Battery backed RAM is a shared mapping of the save file next to the ROM (game.gb -> game.sav),
+ * created or grown to the RAM size on load. Writes land in the page cache and the OS writes them
+ * back whenever it likes (at the latest when the mapping goes away), so there is no save on exit
+ * and a crash loses nothing that was written. Games enable the RAM around saving, so switching it
+ * off again after it was on starts an asynchronous write-back (see flush).
+ */
+class Cartridge {
+public:
+    enum MBC { MBC_NONE = 0, MBC_1, MBC_2, MBC_3, MBC_5 };
+
+    // Regions whose mapping a control write can change
+    enum REMAP : uint8_t {
+        REMAP_ROM0 = 0x01,  // 0x0000-0x3FFF
+        REMAP_ROMX = 0x02,  // 0x4000-0x7FFF
+        REMAP_RAM = 0x04,   // 0xA000-0xBFFF
+    };
+
+    Cartridge() = default;
+    ~Cartridge();
+    Cartridge(const Cartridge&) = delete;
+    Cartridge& operator=(const Cartridge&) = delete;
+
+    // Maps the ROM file and sets the controller up from its header. False if the file can't be read.
+    // persistRam = false keeps battery backed RAM in memory only (parallel runs of the same ROM).
+    bool load(const std::string& path, bool persistRam = true);
+    bool loaded() const { return rom != nullptr; }
+
+    MBC mbc() const { return type; }
+    // e.g. "64KB ROM (MBC1, 4 banks, 8KB RAM, battery)"
+    std::string describe() const;
+    // global checksum from the header (0x014E-0x014F), tells ROMs apart for save states
+    uint16_t checksum() const { return rom ? (uint16_t) (rom[0x14Eu] << 8u | rom[0x14Fu]) : 0; }
+    size_t romSize() const { return romBanks * ROM_BANK_SIZE; }
+    // the whole ROM, romSize() bytes (nullptr if none is loaded)
+    const uint8_t* romData() const { return rom; }
+    size_t ramSize() const { return ramLength; }
+    const uint8_t* ram() const { return ramData; }
+    // true if the external RAM is the mapped save file
+    bool ramPersistent() const { return ramMapped != 0; }
+    // Starts writing RAM changed since the last flush back to the save file, without waiting for it
+    void flush();
+
+    /**
+     * Host pointer to the 256 byte page at addr as currently banked: ROM for 0x0000-0x7FFF, external
+     * RAM for 0xA000-0xBFFF. nullptr if the page can't be accessed directly (RAM disabled or absent,
+     * MBC2 nibble RAM, RTC registers), readRam/writeRam handle those.
+     */
+    const uint8_t* romPage(uint16_t addr) const;
+    uint8_t* ramPage(uint16_t addr);
+
+    // Controller register write (0x0000-0x7FFF) at time `now`. Returns the REMAP bits of the regions
+    // whose mapping changed.
+    uint8_t write(uint16_t addr, uint8_t data, uint64_t now);
+    // External RAM accesses without a direct page
+    uint8_t readRam(uint16_t addr, uint64_t now);
+    void writeRam(uint16_t addr, uint8_t data, uint64_t now);
+
+    // Save state view: controller registers and the clock (the RAM contents go along separately)
+    struct State {
+        uint64_t rtcSeconds;
+        uint64_t rtcSynced;
+        uint32_t bankLow;
+        uint32_t bankHigh;
+        uint8_t rtcLatched[5];
+        uint8_t rtcLatch;
+        bool ramEnabled;
+        bool mode1;
+        bool rtcHalted;
+        bool rtcCarry;
+    };
+    State state() const;
+    // ram: ramSize() bytes
+    void restore(const State& s, const uint8_t* ram);
+
+private:
+    static const size_t ROM_BANK_SIZE = 0x4000;
+    static const size_t RAM_BANK_SIZE = 0x2000;
+
+    void unload();
+    // Maps `length` bytes of the save file as the external RAM. False if it can't be opened or grown.
+    bool mapSaveFile(const std::string& path, size_t length);
+    // ROM bank mapped at 0x0000 and 0x4000 / RAM bank mapped at 0xA000 for the register state
+    unsigned romBank0() const;
+    unsigned romBankX() const;
+    unsigned ramBank() const;
+    bool rtcSelected() const { return type == MBC_3 && bankHigh >= 0x08; }
+    // MBC3 clock: brings the counter up to `now`, and the latched/written register view
+    void rtcCatchUp(uint64_t now);
+    uint8_t rtcRead() const;
+    void rtcWrite(uint8_t data);
+
+    MBC type = MBC_NONE;
+    const uint8_t* rom = nullptr;
+    size_t mappedSize = 0;             // length of the mmap'd file, 0 if rom is the padded copy below
+    std::vector<uint8_t> romCopy;
+    size_t romBanks = 0;
+    uint8_t* ramData = nullptr;        // the mapped save file or ramCopy
+    size_t ramLength = 0;
+    size_t ramMapped = 0;              // length of the save file mapping, 0 if ramData is ramCopy
+    std::vector<uint8_t> ramCopy;
+    bool ramDirty = false;             // RAM was enabled (so may have been written) since the last flush
+
+    // controller registers
+    bool ramEnabled = false;
+    unsigned bankLow = 1;   // ROM bank number (all the bits the MBC has in its low register(s))
+    unsigned bankHigh = 0;  // MBC1 2 bit register, MBC3/5 RAM bank / RTC register select
+    bool mode1 = false;     // MBC1 banking mode
+
+    // MBC3 RTC: seconds counted since `rtcSynced` (clock cycles, remainder carried), the day counter
+    // carry and halt flags, and the registers as last latched
+    uint64_t rtcSeconds = 0;
+    uint64_t rtcSynced = 0;
+    bool rtcHalted = false;
+    bool rtcCarry = false;
+    uint8_t rtcLatched[5] = {};
+    uint8_t rtcLatch = 0xFF;  // last value written to 0x6000-0x7FFF (a 0 -> 1 sequence latches)
+};
+
+
+#endif //NESEMULATOR_CARTRIDGE_H
@@ -0,0 +1,86 @@
+//
+// gameboy-doctor compatible CPU log (see DoctorLog.h).
+//
+
+#include "DoctorLog.h"
+#include <cstring>
+
+namespace {
+
+const char TEMPLATE[] = "A:00 F:00 B:00 C:00 D:00 E:00 H:00 L:00 SP:0000 PC:0000 PCMEM:00,00,00,00\n";
+
+// where the hex digits of each field go in TEMPLATE
+const int REG_AT[TRACE_RECORD::REG_COUNT] = {2, 7, 12, 17, 22, 27, 32, 37};
+const int SP_AT = 43;
+const int PC_AT = 51;
+const int MEM_AT[4] = {62, 65, 68, 71};
+
+// "00".."FF", two characters per byte
+struct HEX_TABLE {
+    char digits[256][2];
+    HEX_TABLE() {
+        const char* hex = "0123456789ABCDEF";
+        for (int i = 0; i < 256; i++) {
+            digits[i][0] = hex[i >> 4];
+            digits[i][1] = hex[i & 0xF];
+        }
+    }
+};
+const HEX_TABLE HEX;
+
+inline void put8(char* out, uint8_t value) {
+    std::memcpy(out, HEX.digits[value], 2);
+}
+
+inline void put16(char* out, uint16_t value) {
+    put8(out, (uint8_t) (value >> 8u));
+    put8(out + 2, (uint8_t) value);
+}
+
+} // namespace
+
+DoctorLog::~DoctorLog() {
+    close();
+}
+
+bool DoctorLog::open(const std::string& path) {
+    if (path == "-") return openStream(stdout);
+    close();
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    openStream(f);
+    ownsFile = true;
+    return true;
+}
+
+bool DoctorLog::openStream(FILE* stream) {
+    close();
+    static_assert(sizeof TEMPLATE - 1 == LINE_LENGTH, "DoctorLog::LINE_LENGTH is out of date");
+    file = stream;
+    ownsFile = false;
+    buffer.resize(BUFFER_SIZE);
+    used = 0;
+    lines = 0;
+    return true;
+}
+
+void DoctorLog::close() {
+    if (!file) return;
+    flush();
+    if (ownsFile) fclose(file);
+    else fflush(file);
+    file = nullptr;
+}
+
+void DoctorLog::flush() {
+    if (used) fwrite(buffer.data(), 1, used, file);
+    used = 0;
+}
+
+void DoctorLog::format(const TRACE_RECORD& record, char* out) {
+    std::memcpy(out, TEMPLATE, LINE_LENGTH);
+    for (int i = 0; i < TRACE_RECORD::REG_COUNT; i++) put8(out + REG_AT[i], record.regs[i]);
+    put16(out + SP_AT, record.sp);
+    put16(out + PC_AT, record.pc);
+    for (int i = 0; i < 4; i++) put8(out + MEM_AT[i], record.mem[i]);
+}
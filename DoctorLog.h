@@ -0,0 +1,67 @@
+//
+// gameboy-doctor compatible CPU log (see Bus::run, tools/gbtrace.cpp).
+//
+
+#ifndef NESEMULATOR_DOCTORLOG_H
+#define NESEMULATOR_DOCTORLOG_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "Trace.h"
+
+/**
+ * Writes one line per instruction in the format the gameboy-doctor tool compares against:
+ *   A:01 F:B0 B:00 C:13 D:00 E:D8 H:01 L:4D SP:FFFE PC:0100 PCMEM:00,C3,13,02
+ * Every line has the same length, so a line is a copy of a template with the hex digits patched in
+ * from a 256 entry table, straight into a large buffer that goes out in one fwrite when it is full.
+ * That keeps a cpu_instrs log (tens of millions of lines) to seconds, where printf takes minutes.
+ */
+class DoctorLog {
+public:
+    static const size_t LINE_LENGTH = 74; // including the newline
+
+    DoctorLog() = default;
+    // Writes out what is buffered and closes the file
+    ~DoctorLog();
+    DoctorLog(const DoctorLog&) = delete;
+    DoctorLog& operator=(const DoctorLog&) = delete;
+
+    // "-" logs to stdout
+    bool open(const std::string& path);
+    bool openStream(FILE* stream);
+    void close();
+    bool isOpen() const { return file != nullptr; }
+
+    void write(const TRACE_RECORD& record) {
+        if (buffer.size() - used < LINE_LENGTH) flush();
+        format(record, buffer.data() + used);
+        used += LINE_LENGTH;
+        lines++;
+    }
+    // The line for the instruction about to run on `bus`
+    void write(Bus& bus) {
+        TRACE_RECORD record;
+        TraceRecorder::capture(bus, record);
+        write(record);
+    }
+    void flush();
+
+    uint64_t count() const { return lines; }
+
+    // Formats one line (LINE_LENGTH bytes, newline included, no terminator) into `out`
+    static void format(const TRACE_RECORD& record, char* out);
+
+private:
+    static const size_t BUFFER_SIZE = 4u << 20u;
+
+    FILE* file = nullptr;
+    bool ownsFile = false;
+    std::vector<char> buffer;
+    size_t used = 0;
+    uint64_t lines = 0;
+};
+
+
+#endif //NESEMULATOR_DOCTORLOG_H
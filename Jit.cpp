@@ -0,0 +1,650 @@
+//
+// x86-64 JIT backend for hot basic blocks (see Jit.h for the register mapping).
+//
+
+#include "Jit.h"
+#include "BlockCache.h"
+#include "CPU.h"
+#include "Bus.h"
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using std::uint8_t;
+using std::uint16_t;
+using std::uint32_t;
+using std::uint64_t;
+
+namespace {
+
+enum HostReg {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R12 = 12, R13 = 13, R14 = 14, R15 = 15,
+};
+
+// GB register encoding used by the opcodes: B, C, D, E, H, L, (HL), A
+const int REG_HL_INDIRECT = 6;
+const int REG_A = 7;
+
+// Host register holding the GB register pair of an 8-bit opcode register
+HostReg pairOf(int r) {
+    switch (r) {
+        case 0: case 1: return R13;
+        case 2: case 3: return R14;
+        case 4: case 5: return R15;
+        default: return R12;
+    }
+}
+
+bool isHigh(int r) { return r == 0 || r == 2 || r == 4; }
+
+// lazy flags image (Z bit 6, H bit 4, N bit 3, C bit 0) -> GB F, and GB F >> 4 -> image
+uint8_t imageToF[256];
+uint8_t fToImage[16];
+
+void buildFlagTables() {
+    for (int i = 0; i < 256; i++) {
+        imageToF[i] = (uint8_t)(((i & 0x40) ? CPU::Z : 0) | ((i & 0x08) ? CPU::N : 0) |
+                                ((i & 0x10) ? CPU::H : 0) | ((i & 0x01) ? CPU::C : 0));
+    }
+    for (int f = 0; f < 16; f++) {
+        fToImage[f] = (uint8_t)(((f & 0x8) ? 0x40 : 0) | ((f & 0x4) ? 0x08 : 0) |
+                                ((f & 0x2) ? 0x10 : 0) | ((f & 0x1) ? 0x01 : 0));
+    }
+}
+
+/**
+ * Minimal x86-64 encoder for the handful of instruction forms the JIT needs.
+ */
+class Emitter {
+public:
+    std::vector<uint8_t> code;
+
+    void byte(uint8_t b) { code.push_back(b); }
+    void word(uint16_t w) { byte(w & 0xFFu); byte(w >> 8u); }
+    void dword(uint32_t d) { for (int i = 0; i < 4; i++) byte((d >> (8 * i)) & 0xFFu); }
+    void qword(uint64_t q) { for (int i = 0; i < 8; i++) byte((q >> (8 * i)) & 0xFFu); }
+
+    // REX prefix; `byteRegs` forces one so spl/bpl/sil/dil are addressable
+    void rex(bool w, int reg, int base, bool byteRegs = false) {
+        uint8_t r = 0x40u | (w ? 0x08u : 0u) | ((reg >> 3) & 1) << 2 | ((base >> 3) & 1);
+        if (r != 0x40u || byteRegs) byte(r);
+    }
+    void modrmReg(int reg, int rm) { byte(0xC0u | (reg & 7) << 3 | (rm & 7)); }
+    // [base + disp32]
+    void modrmMem(int reg, int base, int32_t disp) {
+        byte(0x80u | (reg & 7) << 3 | (base & 7));
+        if ((base & 7) == RSP) byte(0x24);
+        dword((uint32_t) disp);
+    }
+    static bool needsByteRex(int r) { return r >= 4 && r < 8; }
+
+    void movImm32(int r, uint32_t imm) { rex(false, 0, r); byte(0xB8 + (r & 7)); dword(imm); }
+    void movImm64(int r, uint64_t imm) { rex(true, 0, r); byte(0xB8 + (r & 7)); qword(imm); }
+    void movImm64(int r, const void* p) { movImm64(r, (uint64_t) (uintptr_t) p); }
+    void mov32(int dst, int src) { rex(false, src, dst); byte(0x89); modrmReg(src, dst); }
+    void movzx8(int dst, int src) { rex(false, dst, src, needsByteRex(src)); byte(0x0F); byte(0xB6); modrmReg(dst, src); }
+    void movzxAh(int dst) { byte(0x0F); byte(0xB6); modrmReg(dst, 4); } // dst must be eax..edi
+    void load8(int dst, int base, int32_t disp) { rex(false, dst, base); byte(0x0F); byte(0xB6); modrmMem(dst, base, disp); }
+    void load16(int dst, int base, int32_t disp) { rex(false, dst, base); byte(0x0F); byte(0xB7); modrmMem(dst, base, disp); }
+    void load32(int dst, int base, int32_t disp) { rex(false, dst, base); byte(0x8B); modrmMem(dst, base, disp); }
+    void add32Mem(int dst, int base, int32_t disp) { rex(false, dst, base); byte(0x03); modrmMem(dst, base, disp); }
+    void store8(int base, int32_t disp, int src) { rex(false, src, base, needsByteRex(src)); byte(0x88); modrmMem(src, base, disp); }
+    void store16(int base, int32_t disp, int src) { byte(0x66); rex(false, src, base); byte(0x89); modrmMem(src, base, disp); }
+    void store32(int base, int32_t disp, int src) { rex(false, src, base); byte(0x89); modrmMem(src, base, disp); }
+    void store16Imm(int base, int32_t disp, uint16_t imm) { byte(0x66); rex(false, 0, base); byte(0xC7); modrmMem(0, base, disp); word(imm); }
+    // movzx eax, byte [rcx + rax]
+    void loadIndexed8() { byte(0x0F); byte(0xB6); byte(0x04); byte(0x01); }
+
+    enum AluOp { ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+    void alu32Imm(AluOp op, int r, uint32_t imm) { rex(false, 0, r); byte(0x81); modrmReg(op, r); dword(imm); }
+    void alu32(AluOp op, int dst, int src) { rex(false, src, dst); byte(op * 8 + 1); modrmReg(src, dst); }
+    void alu8(AluOp op, int dst, int src) {
+        rex(false, src, dst, needsByteRex(src) || needsByteRex(dst));
+        byte(op * 8); modrmReg(src, dst);
+    }
+    void shl32(int r, uint8_t n) { rex(false, 0, r); byte(0xC1); modrmReg(4, r); byte(n); }
+    void shr32(int r, uint8_t n) { rex(false, 0, r); byte(0xC1); modrmReg(5, r); byte(n); }
+    void inc8(int r) { rex(false, 0, r, needsByteRex(r)); byte(0xFE); modrmReg(0, r); }
+    void dec8(int r) { rex(false, 0, r, needsByteRex(r)); byte(0xFE); modrmReg(1, r); }
+    void lahf() { byte(0x9F); }
+    void callRax() { byte(0xFF); byte(0xD0); }
+    void push(int r) { rex(false, 0, r); byte(0x50 + (r & 7)); }
+    void pop(int r) { rex(false, 0, r); byte(0x58 + (r & 7)); }
+    void ret() { byte(0xC3); }
+
+    // conditional / unconditional rel32 jumps, patched with bind()
+    enum Cond { JB = 0x2, JAE = 0x3, JE = 0x4, JNE = 0x5 };
+    size_t jcc(Cond cc) { byte(0x0F); byte(0x80 + cc); dword(0); return code.size(); }
+    size_t jmp() { byte(0xE9); dword(0); return code.size(); }
+    void bind(size_t fixup) {
+        int32_t rel = (int32_t) (code.size() - fixup);
+        std::memcpy(&code[fixup - 4], &rel, 4);
+    }
+};
+
+} // namespace
+
+JitCompiler::JitCompiler(CPU& cpu) : cpu(cpu) {
+    // once per process; a function local static is initialized thread safely (one Bus per thread)
+    static const bool tablesBuilt = (buildFlagTables(), true);
+    (void) tablesBuilt;
+    // W^X: the arena is never writable and executable at once, compile() flips the pages it writes
+    void* p = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) arena = static_cast<uint8_t*>(p);
+}
+
+JitCompiler::~JitCompiler() {
+    if (arena) munmap(arena, ARENA_SIZE);
+}
+
+namespace {
+
+// Slow paths the compiled code calls out to (System V: rdi, esi, edx)
+int jitRead(CPU* cpu, uint32_t addr);
+void jitWrite(CPU* cpu, uint32_t addr, uint32_t data);
+void jitFlushFlags(CPU* cpu);
+
+/**
+ * Per-block code generator. Keeps track of the cycles of natively emitted instructions so
+ * every exit can return the exact total the interpreter would have returned.
+ */
+class BlockCompiler {
+public:
+    BlockCompiler(CPU& cpu, int offA, int offF, int offBC, int offDE, int offHL, int offPC, int offSP, int offRun,
+                  int offRetired, const bool* runBreak, const void* lazyOp, uint8_t* const* readPages,
+                  uint8_t* const* writePages, uint64_t* writeHash)
+            : cpu(cpu), offA(offA), offF(offF), offBC(offBC), offDE(offDE), offHL(offHL), offPC(offPC),
+              offSP(offSP), offRun(offRun), offRetired(offRetired), runBreak(runBreak), lazyOp(lazyOp),
+              readPages(readPages), writePages(writePages), writeHash(writeHash) {}
+
+    Emitter e;
+
+    void prologue(const CPU::REGS* regs) {
+        e.push(RBX); e.push(RBP); e.push(R12); e.push(R13); e.push(R14); e.push(R15);
+        // sub rsp, 24 -> 16 byte aligned for calls, [rsp] holds the handler cycles,
+        // [rsp + 8] CPU::runCycles at entry
+        e.byte(0x48); e.byte(0x83); e.byte(0xEC); e.byte(0x18);
+        e.byte(0xC7); e.byte(0x04); e.byte(0x24); e.dword(0);
+        e.movImm64(RBX, regs);
+        e.load32(RAX, RBX, offRun);
+        e.store32(RSP, 8, RAX);
+        reload();
+    }
+
+    void spill() {
+        e.store8(RBX, offA, R12);
+        e.store16(RBX, offBC, R13);
+        e.store16(RBX, offDE, R14);
+        e.store16(RBX, offHL, R15);
+        // F = imageToF[ebp] | (F & 0x0F)
+        e.movzx8(RAX, RBP);
+        e.movImm64(RCX, imageToF);
+        e.loadIndexed8();
+        e.load8(RDX, RBX, offF);
+        e.alu32Imm(Emitter::AND, RDX, 0x0F);
+        e.alu32(Emitter::OR, RAX, RDX);
+        e.store8(RBX, offF, RAX);
+    }
+
+    void reload() {
+        e.load8(R12, RBX, offA);
+        e.load16(R13, RBX, offBC);
+        e.load16(R14, RBX, offDE);
+        e.load16(R15, RBX, offHL);
+        e.load8(RAX, RBX, offF);
+        e.shr32(RAX, 4);
+        e.movImm64(RCX, fToImage);
+        e.loadIndexed8();
+        e.mov32(RBP, RAX);
+    }
+
+    // pc < 0: regs.pc was already set by a handler
+    void exit(int pc) {
+        spill();
+        if (pc >= 0) e.store16Imm(RBX, offPC, (uint16_t) pc);
+        // add qword [rbx + offRetired], instructions
+        e.byte(0x48); e.byte(0x81); e.byte(0x83); e.dword((uint32_t) offRetired); e.dword((uint32_t) instructions);
+        // mov eax, [rsp]; add eax, cycles
+        e.byte(0x8B); e.byte(0x04); e.byte(0x24);
+        e.alu32Imm(Emitter::ADD, RAX, (uint32_t) cycles);
+        e.byte(0x48); e.byte(0x83); e.byte(0xC4); e.byte(0x18);
+        e.pop(R15); e.pop(R14); e.pop(R13); e.pop(R12); e.pop(RBP); e.pop(RBX);
+        e.ret();
+    }
+
+    // CPU::runCycles = cycles before the current instruction, so the Bus knows the time of an access
+    // made by a call out. Clobbers ecx.
+    void syncRunCycles() {
+        e.load32(RCX, RSP, 0);
+        e.add32Mem(RCX, RSP, 8);
+        e.alu32Imm(Emitter::ADD, RCX, (uint32_t) opStart);
+        e.store32(RBX, offRun, RCX);
+    }
+
+    // leave right here if the last call out raised runBreak
+    void checkBreak(int pc) {
+        e.movImm64(RAX, runBreak);
+        e.byte(0x80); e.byte(0x38); e.byte(0x00); // cmp byte [rax], 0
+        size_t stay = e.jcc(Emitter::JE);
+        exit(pc);
+        e.bind(stay);
+    }
+
+    // 8-bit GB register r -> host register dst (zero extended)
+    void extract(int r, int dst) {
+        HostReg pair = pairOf(r);
+        if (r == REG_A) e.mov32(dst, R12);
+        else if (isHigh(r)) { e.mov32(dst, pair); e.shr32(dst, 8); }
+        else e.movzx8(dst, pair);
+    }
+
+    // host register src (0..255) -> 8-bit GB register r; clobbers src
+    void insert(int r, int src) {
+        HostReg pair = pairOf(r);
+        if (r == REG_A) { e.mov32(R12, src); return; }
+        if (isHigh(r)) {
+            e.alu32Imm(Emitter::AND, pair, 0x00FF);
+            e.shl32(src, 8);
+        } else {
+            e.alu32Imm(Emitter::AND, pair, 0xFF00);
+        }
+        e.alu32(Emitter::OR, pair, src);
+    }
+
+    // eax = address -> eax = value, through Bus::readPages; unmapped pages call out to CPU::READ
+    void read() {
+        pageLookup(RDX, readPages);
+        size_t slow = e.jcc(Emitter::JE);
+        e.byte(0x0F); e.byte(0xB6); e.byte(0xC8); // movzx ecx, al
+        e.byte(0x0F); e.byte(0xB6); e.byte(0x04); e.byte(0x0A); // movzx eax, byte [rdx + rcx]
+        size_t done = e.jmp();
+        e.bind(slow);
+        syncRunCycles();
+        e.mov32(RSI, RAX);
+        e.movImm64(RDI, &cpu);
+        e.movImm64(RAX, (const void*) &jitRead);
+        e.callRax();
+        e.bind(done);
+    }
+
+    // eax = address, edx = value. I/O writes can raise runBreak, so the block may end here.
+    void write(int pcAfter) {
+        pageLookup(RSI, writePages);
+        size_t slow = e.jcc(Emitter::JE);
+        e.byte(0x0F); e.byte(0xB6); e.byte(0xC8); // movzx ecx, al
+        e.byte(0x88); e.byte(0x14); e.byte(0x0E); // mov [rsi + rcx], dl
+        if (writeHash) hashWrite();
+        size_t done = e.jmp();
+        e.bind(slow);
+        syncRunCycles();
+        e.mov32(RSI, RAX);
+        e.movImm64(RDI, &cpu);
+        e.movImm64(RAX, (const void*) &jitWrite);
+        e.callRax();
+        checkBreak(pcAfter);
+        e.bind(done);
+    }
+
+    // Bus::hashWrite for a direct page store (the slow path hashes in CPU::WRITE). eax = address,
+    // edx = value; clobbers rax, rcx, rdx like the call out would.
+    void hashWrite() {
+        e.mov32(RCX, RAX);
+        e.shl32(RCX, 8);
+        e.movzx8(RDX, RDX);
+        e.alu32(Emitter::OR, RCX, RDX);
+        e.movImm64(RAX, writeHash);
+        e.byte(0x48); e.byte(0x33); e.byte(0x08); // xor rcx, [rax]
+        e.movImm64(RDX, Bus::WRITE_HASH_PRIME);
+        e.byte(0x48); e.byte(0x0F); e.byte(0xAF); e.byte(0xCA); // imul rcx, rdx
+        e.byte(0x48); e.byte(0x89); e.byte(0x08); // mov [rax], rcx
+    }
+
+    // page = table[eax >> 8]; leaves ZF set if the page has no direct mapping. Clobbers ecx.
+    void pageLookup(HostReg page, uint8_t* const* table) {
+        e.mov32(RCX, RAX);
+        e.shr32(RCX, Bus::PAGE_SHIFT);
+        e.movImm64(page, table);
+        // mov page, [page + rcx*8]
+        e.byte(0x48); e.byte(0x8B); e.byte(0x04 | (page & 7) << 3); e.byte(0xC8 | (page & 7));
+        // test page, page
+        e.byte(0x48); e.byte(0x85); e.modrmReg(page, page);
+    }
+
+    void incPair(HostReg pair, bool dec) {
+        e.alu32Imm(dec ? Emitter::SUB : Emitter::ADD, pair, 1);
+        e.alu32Imm(Emitter::AND, pair, 0xFFFF);
+    }
+
+    // ADD/SUB/XOR/CP A, ecx
+    void alu(Emitter::AluOp op) {
+        e.alu8(op, R12, RCX);
+        e.lahf();
+        e.movzxAh(RCX);
+        e.alu32Imm(Emitter::AND, RCX, op == Emitter::XOR ? 0x40 : 0x51);
+        if (op == Emitter::SUB || op == Emitter::CMP) e.alu32Imm(Emitter::OR, RCX, 0x08);
+        e.mov32(RBP, RCX);
+    }
+
+    // INC/DEC r: C survives from the previous image
+    void incDec8(int r, bool dec) {
+        extract(r, RAX);
+        if (dec) e.dec8(RAX); else e.inc8(RAX);
+        e.lahf();
+        e.movzxAh(RCX);
+        e.movzx8(RAX, RAX);
+        e.alu32Imm(Emitter::AND, RCX, 0x50);
+        e.alu32Imm(Emitter::AND, RBP, 0x01);
+        e.alu32(Emitter::OR, RBP, RCX);
+        if (dec) e.alu32Imm(Emitter::OR, RBP, 0x08);
+        insert(r, RAX);
+    }
+
+    void callHandler(const MicroOp& op, uint16_t pcAfter) {
+        spill();
+        syncRunCycles();
+        e.store16Imm(RBX, offPC, pcAfter);
+        e.movImm64(RDI, &cpu);
+        e.movImm32(RSI, op.operand);
+        e.movImm64(RAX, (const void*) op.exec);
+        e.callRax();
+        e.byte(0x01); e.byte(0x04); e.byte(0x24); // add [rsp], eax
+        // the handler may have left its flags pending (CPU::LAZY_FLAGS)
+        e.movImm64(RAX, lazyOp);
+        e.byte(0x80); e.byte(0x38); e.byte(0x00); // cmp byte [rax], 0
+        size_t clean = e.jcc(Emitter::JE);
+        e.movImm64(RDI, &cpu);
+        e.movImm64(RAX, (const void*) &jitFlushFlags);
+        e.callRax();
+        e.bind(clean);
+        reload();
+    }
+
+    /**
+     * Emit one instruction natively. Returns false if it has to go through its handler.
+     * `cycles` must match what the interpreter handler returns.
+     */
+    bool emitNative(const MicroOp& op, uint16_t pcAfter, bool& exited) {
+        uint16_t code = op.code;
+        if (code > 0xFF) return false;
+        int dst = (code >> 3) & 7, src = code & 7;
+
+        if (code == 0x00) { cycles += 1; return true; }
+        // LD rr,nn
+        if (code == 0x01 || code == 0x11 || code == 0x21) {
+            e.movImm32(code == 0x01 ? R13 : code == 0x11 ? R14 : R15, op.operand);
+            cycles += 3;
+            return true;
+        }
+        if (code == 0x31) { e.store16Imm(RBX, offSP, op.operand); cycles += 3; return true; }
+        // INC rr / DEC rr
+        if (code == 0x03 || code == 0x13 || code == 0x23 || code == 0x0B || code == 0x1B || code == 0x2B) {
+            incPair(code >> 4 == 0 ? R13 : code >> 4 == 1 ? R14 : R15, (code & 0x0F) == 0x0B);
+            cycles += 2;
+            return true;
+        }
+        // INC r / DEC r (the (HL) forms go through their handlers)
+        if (code < 0x40 && (src == 4 || src == 5) && dst != REG_HL_INDIRECT) {
+            incDec8(dst, src == 5);
+            cycles += 1;
+            return true;
+        }
+        // LD r,n
+        if (code < 0x40 && src == 6 && dst != REG_HL_INDIRECT) {
+            e.movImm32(RAX, op.operand & 0xFFu);
+            insert(dst, RAX);
+            cycles += 2;
+            return true;
+        }
+        // LD (HL),n
+        if (code == 0x36) {
+            e.movImm32(RDX, op.operand & 0xFFu);
+            e.mov32(RAX, R15);
+            cycles += 3;
+            write(pcAfter);
+            return true;
+        }
+        // LD (BC),A / LD (DE),A / LD A,(BC) / LD A,(DE)
+        if (code == 0x02 || code == 0x12) {
+            e.mov32(RDX, R12);
+            e.mov32(RAX, code == 0x02 ? R13 : R14);
+            cycles += 2;
+            write(pcAfter);
+            return true;
+        }
+        if (code == 0x0A || code == 0x1A) {
+            e.mov32(RAX, code == 0x0A ? R13 : R14);
+            read();
+            e.mov32(R12, RAX);
+            cycles += 2;
+            return true;
+        }
+        // LD (HL+/-),A and LD A,(HL+/-): HL is updated before the access so an early exit sees it
+        if (code == 0x22 || code == 0x32) {
+            e.mov32(RDX, R12);
+            e.mov32(RAX, R15);
+            incPair(R15, code == 0x32);
+            cycles += 2;
+            write(pcAfter);
+            return true;
+        }
+        if (code == 0x2A || code == 0x3A) {
+            e.mov32(RAX, R15);
+            incPair(R15, code == 0x3A);
+            read();
+            e.mov32(R12, RAX);
+            cycles += 2;
+            return true;
+        }
+        // LD r,r' / LD r,(HL) / LD (HL),r
+        if (code >= 0x40 && code < 0x80 && code != 0x76) {
+            if (src == REG_HL_INDIRECT) {
+                e.mov32(RAX, R15);
+                read();
+                insert(dst, RAX);
+                cycles += 2;
+            } else if (dst == REG_HL_INDIRECT) {
+                extract(src, RDX);
+                e.mov32(RAX, R15);
+                cycles += 2;
+                write(pcAfter);
+            } else {
+                extract(src, RAX);
+                insert(dst, RAX);
+                cycles += 1;
+            }
+            return true;
+        }
+        // ADD/SUB/XOR/CP A,r and A,(HL)
+        if (code >= 0x80 && code < 0xC0) {
+            Emitter::AluOp aluOp;
+            switch (dst) {
+                case 0: aluOp = Emitter::ADD; break;
+                case 2: aluOp = Emitter::SUB; break;
+                case 5: aluOp = Emitter::XOR; break;
+                case 7: aluOp = Emitter::CMP; break;
+                default: return false;
+            }
+            if (src == REG_HL_INDIRECT) {
+                e.mov32(RAX, R15);
+                read();
+                e.mov32(RCX, RAX);
+                cycles += 2;
+            } else {
+                extract(src, RCX);
+                cycles += 1;
+            }
+            alu(aluOp);
+            return true;
+        }
+        // ADD/SUB/XOR/CP A,n
+        if (code == 0xC6 || code == 0xD6 || code == 0xEE || code == 0xFE) {
+            e.movImm32(RCX, op.operand & 0xFFu);
+            alu(code == 0xC6 ? Emitter::ADD : code == 0xD6 ? Emitter::SUB : code == 0xEE ? Emitter::XOR : Emitter::CMP);
+            cycles += 2;
+            return true;
+        }
+        // LDH (n),A / LDH A,(n): always I/O or HRAM, straight to the slow paths
+        if (code == 0xE0) {
+            e.mov32(RDX, R12);
+            e.movImm32(RAX, 0xFF00u + (op.operand & 0xFFu));
+            cycles += 3;
+            write(pcAfter);
+            return true;
+        }
+        if (code == 0xF0) {
+            e.movImm32(RAX, 0xFF00u + (op.operand & 0xFFu));
+            read();
+            e.mov32(R12, RAX);
+            cycles += 3;
+            return true;
+        }
+        // JP nn / JR e end the block
+        if (code == 0xC3) {
+            cycles += 4;
+            exit(op.operand);
+            exited = true;
+            return true;
+        }
+        if (code == 0x18) {
+            cycles += 3;
+            exit((uint16_t)(pcAfter + (int8_t) op.operand));
+            exited = true;
+            return true;
+        }
+        return false;
+    }
+
+    int cycles = 0;
+    // `cycles` at the start of the instruction being emitted
+    int opStart = 0;
+    // instructions done by an exit emitted now (including the one being emitted)
+    int instructions = 0;
+
+private:
+    CPU& cpu;
+    int offA, offF, offBC, offDE, offHL, offPC, offSP, offRun, offRetired;
+    const bool* runBreak;
+    const void* lazyOp;
+    uint8_t* const* readPages;
+    uint8_t* const* writePages;
+    uint64_t* writeHash; // Bus::writeHash if the Bus hashes writes, else nullptr
+};
+
+} // namespace
+
+int (*JitCompiler::compile(const BasicBlock& block))(CPU*) {
+    if (!arena || full()) return nullptr;
+
+    const auto* base = reinterpret_cast<const uint8_t*>(&cpu.regs);
+    auto off = [base](const void* p) { return (int) (reinterpret_cast<const uint8_t*>(p) - base); };
+    BlockCompiler bc(cpu, off(&cpu.regs.af.A), off(&cpu.regs.af.F), off(&cpu.regs.bc.BC), off(&cpu.regs.de.DE),
+                     off(&cpu.regs.hl.HL), off(&cpu.regs.pc), off(&cpu.regs.sp), off(&cpu.runCycles), off(&cpu.retired), &cpu.runBreak,
+                     &cpu.lazyFlags.op, cpu.bus->readPages.data(), cpu.bus->writePages.data(),
+                     cpu.bus->hashWrites ? &cpu.bus->writeHash : nullptr);
+
+    bc.prologue(&cpu.regs);
+    uint16_t pc = block.start;
+    bool exited = false;
+    for (size_t i = 0; i < block.ops.size() && !exited; i++) {
+        const MicroOp& op = block.ops[i];
+        pc = (uint16_t)(pc + op.length);
+        bc.opStart = bc.cycles;
+        bc.instructions = (int) i + 1;
+        if (bc.emitNative(op, pc, exited)) continue;
+
+        bc.callHandler(op, pc);
+        if (i + 1 == block.ops.size()) {
+            // handlers ending a block (branches, RET, HALT...) set regs.pc themselves
+            bc.exit(-1);
+            exited = true;
+        } else {
+            bc.checkBreak(-1);
+        }
+    }
+    if (!exited) bc.exit(pc);
+
+    if (bc.e.code.size() > MAX_BLOCK_CODE) return nullptr;
+    uint8_t* dst = arena + used;
+    // the pages may hold other blocks, but no compiled code runs while compiling
+    static const uintptr_t PAGE = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t first = reinterpret_cast<uintptr_t>(dst) & ~(PAGE - 1);
+    size_t length = reinterpret_cast<uintptr_t>(dst) + bc.e.code.size() - first;
+    auto* pages = reinterpret_cast<void*>(first);
+    if (mprotect(pages, length, PROT_READ | PROT_WRITE) != 0) return nullptr;
+    std::memcpy(dst, bc.e.code.data(), bc.e.code.size());
+    if (mprotect(pages, length, PROT_READ | PROT_EXEC) != 0) return nullptr;
+    used += (bc.e.code.size() + 15) & ~(size_t) 15;
+    return reinterpret_cast<int (*)(CPU*)>(dst);
+}
+
+namespace {
+
+int jitRead(CPU* cpu, uint32_t addr) {
+    return JitCompiler::read(*cpu, (uint16_t) addr);
+}
+
+void jitWrite(CPU* cpu, uint32_t addr, uint32_t data) {
+    JitCompiler::write(*cpu, (uint16_t) addr, (uint8_t) data);
+}
+
+void jitFlushFlags(CPU* cpu) {
+    cpu->flushFlags();
+}
+
+} // namespace
+
+uint8_t JitCompiler::read(CPU& cpu, uint16_t addr) {
+    return cpu.READ(addr);
+}
+
+void JitCompiler::write(CPU& cpu, uint16_t addr, uint8_t data) {
+    cpu.WRITE(addr, data);
+}
+
+/**
+ * JIT core: the block core, except that a block which ran jitThreshold times gets compiled and
+ * from then on runs natively. A native block can't stop between instructions, so it is only used
+ * when the whole block fits into the remaining budget (this also single-steps an EI delay).
+ */
+int CPU::runJit(int budget) {
+    if (!jit) jit.reset(new JitCompiler(*this));
+    if (jit->full()) {
+        // nothing compiled is running here, so the arena can start over
+        blockCache.clear();
+        jit->reset();
+    }
+    blockCache.collect();
+    int spent = 0;
+    runBreak = false;
+    while (spent < budget && !runBreak) {
+        BasicBlock* block = regs.pc < BlockCache::CACHED_END ? blockCache.find(regs.pc) : nullptr;
+        if (!block && regs.pc < BlockCache::CACHED_END) block = decodeBlock(regs.pc);
+        runCycles = spent;
+        if (!block) {
+            spent += stepTable();
+            retired++;
+            continue;
+        }
+        int slack = interrupts_cycles_left_to_enabled != 0 ? 0 : budget - spent;
+        if (block->native && block->cycles <= slack) {
+            // compiled code works on F directly
+            flushFlags();
+            spent += block->native(this);
+            continue;
+        }
+        if (!block->native && jit->available() && ++block->execCount == jitThreshold) {
+            block->native = jit->compile(*block);
+            // out of arena: count up to the threshold again, by then runJit has started it over
+            if (!block->native && jit->full()) block->execCount = 0;
+        }
+        for (const MicroOp& op : block->ops) {
+            regs.pc += op.length;
+            runCycles = spent;
+            retired++;
+            spent += op.exec(*this, op.operand);
+            if (spent >= budget || runBreak) return spent;
+        }
+    }
+    return spent;
+}
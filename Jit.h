@@ -0,0 +1,58 @@
+//
+// x86-64 JIT backend for hot basic blocks (see CPU::runJit).
+//
+
+#ifndef NESEMULATOR_JIT_H
+#define NESEMULATOR_JIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class CPU;
+struct BasicBlock;
+
+/**
+ * Compiles BasicBlocks into native x86-64 code.
+ *
+ * Register mapping inside a compiled block:
+ *   rbx = &cpu.regs, r12d = A, r13d = BC, r14d = DE, r15d = HL
+ *   ebp = lazy flags: the host flags image (lahf layout: ZF bit 6, AF bit 4, CF bit 0) of the last
+ *         ALU operation plus N in bit 3. F is only rebuilt from it when the block exits or calls out
+ *         (handlers called out to may leave CPU::lazyFlags pending, that is flushed before reloading).
+ *   [rsp] = cycles returned by handlers the block called out to, [rsp + 8] = CPU::runCycles at entry
+ *           (both go into CPU::runCycles before every call out, see Bus::now)
+ *
+ * Loads, register ALU ops (ADD/SUB/XOR/CP, INC/DEC) and JP/JR are emitted natively. Every other
+ * instruction calls its pre-decoded handler with the registers spilled. Memory accesses are inlined
+ * through the Bus page tables; only pages without a direct mapping (I/O, writes into ROM...) call
+ * out to CPU::READ/WRITE.
+ * Compiled code lives in one arena owned by the compiler; its pages are writable or executable, never both.
+ */
+class JitCompiler {
+public:
+    explicit JitCompiler(CPU& cpu);
+    ~JitCompiler();
+
+    // false when no executable memory could be mapped; runJit then behaves like runBlocks
+    bool available() const { return arena != nullptr; }
+    // nullptr if the arena is full (call reset() at a point where no compiled code is running)
+    int (*compile(const BasicBlock& block))(CPU*);
+    bool full() const { return used + MAX_BLOCK_CODE > ARENA_SIZE; }
+    void reset() { used = 0; }
+
+    // Slow paths of the compiled memory accesses (CPU::READ/WRITE are private)
+    static uint8_t read(CPU& cpu, uint16_t addr);
+    static void write(CPU& cpu, uint16_t addr, uint8_t data);
+
+private:
+    static const size_t ARENA_SIZE = 8 * 1024 * 1024;
+    static const size_t MAX_BLOCK_CODE = 16 * 1024;
+
+    CPU& cpu;
+    uint8_t* arena = nullptr;
+    size_t used = 0;
+};
+
+
+#endif //NESEMULATOR_JIT_H
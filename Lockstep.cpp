@@ -0,0 +1,184 @@
+//
+// Differential execution of two CPU cores over the same ROM (see Lockstep.h).
+//
+
+#include "Lockstep.h"
+#include <cstdio>
+
+namespace {
+
+void printRegs(const char* label, const CPU::REGS& r) {
+    printf("%sAF 0x%04x BC 0x%04x DE 0x%04x HL 0x%04x SP 0x%04x PC 0x%04x", label, r.af.AF, r.bc.BC, r.de.DE,
+           r.hl.HL, r.sp, r.pc);
+}
+
+bool sameRegs(const CPU::REGS& a, const CPU::REGS& b) {
+    return a.af.AF == b.af.AF && a.bc.BC == b.bc.BC && a.de.DE == b.de.DE && a.hl.HL == b.hl.HL &&
+           a.sp == b.sp && a.pc == b.pc;
+}
+
+} // namespace
+
+Lockstep::Lockstep(const std::string& romPath, bool skipBoot, CPU::DISPATCH_MODE referenceMode,
+                   CPU::DISPATCH_MODE testMode, bool everyInstruction)
+        : reference(new Bus()), test(new Bus()), referenceMode(referenceMode), testMode(testMode),
+          everyInstruction(everyInstruction) {
+    reference->cpu.dispatchMode = referenceMode;
+    test->cpu.dispatchMode = testMode;
+    // only the test side prints the serial output and what it loaded
+    reference->serialEcho = false;
+    reference->verbose = false;
+    // both sides would share one save file
+    reference->batterySave = false;
+    test->batterySave = false;
+    reference->hashWrites = true;
+    test->hashWrites = true;
+    reference->init(romPath, skipBoot);
+    test->init(romPath, skipBoot);
+}
+
+const char* Lockstep::coreName(CPU::DISPATCH_MODE mode) {
+    switch (mode) {
+        case CPU::DISPATCH_SWITCH: return "switch";
+        case CPU::DISPATCH_TABLE: return "table";
+        case CPU::DISPATCH_THREADED: return "threaded";
+        case CPU::DISPATCH_BLOCK: return "block";
+#if GB_JIT
+        case CPU::DISPATCH_JIT: return "jit";
+#endif
+    }
+    return "?";
+}
+
+bool Lockstep::run(uint64_t maxCycles) {
+    CPU& dut = test->cpu;
+    printf("lockstep: %s core against the %s core%s\n", coreName(testMode), coreName(referenceMode),
+           everyInstruction ? ", every instruction" : "");
+    while (totalCycles < maxCycles) {
+        if (test->haltedForever() || reference->haltedForever() || !dut.unpaused) {
+            printf("\nlockstep: stopped at a HALT/STOP nothing can wake after %llu cycles\n",
+                   (unsigned long long) totalCycles);
+            return !diverged(testChunks[(chunkCount - 1) % HISTORY], 0, true);
+        }
+        CHUNK& chunk = testChunks[chunkCount++ % HISTORY];
+        chunk.clock = test->clock;
+        chunk.pc = dut.regs.pc;
+        uint64_t refStart = reference->clock;
+        uint64_t retiredBefore = dut.instructions();
+        chunk.cycles = test->runChunk(everyInstruction && !dut.HALT_FLAG ? 1 : MAX_CHUNK_CYCLES);
+        chunk.instructions = dut.instructions() - retiredBefore;
+        catchUpReference();
+        int refCycles = (int) ((reference->clock - refStart) / 4);
+
+        chunks++;
+        if (diverged(chunk, refCycles, chunks % FULL_COMPARE_CHUNKS == 0)) return false;
+        totalCycles += chunk.cycles;
+    }
+    if (diverged(testChunks[(chunkCount - 1) % HISTORY], 0, true)) return false;
+    printf("\nlockstep: no divergence in %llu cycles (%llu chunks, %llu instructions)\n",
+           (unsigned long long) totalCycles, (unsigned long long) chunks,
+           (unsigned long long) dut.instructions());
+    return true;
+}
+
+void Lockstep::catchUpReference() {
+    CPU& ref = reference->cpu;
+    // single instructions (servicing its own events) until it caught up; a HALT is skipped in one go like
+    // on the test side
+    while (reference->clock < test->clock && !reference->haltedForever()) {
+        if (ref.HALT_FLAG) {
+            reference->runChunk((int) ((test->clock - reference->clock + 3) / 4));
+            continue;
+        }
+        STEP& step = steps[stepCount++ % HISTORY];
+        step.clock = reference->clock;
+        step.pc = ref.regs.pc;
+        step.opcode = reference->READ(step.pc);
+        step.cbOpcode = reference->READ((uint16_t) (step.pc + 1));
+        reference->runChunk(1);
+        ref.flushFlags();
+        step.regs = ref.regs;
+    }
+}
+
+bool Lockstep::diverged(const CHUNK& chunk, int refCycles, bool fullCompare) {
+    CPU::State r = reference->cpu.state();
+    CPU::State t = test->cpu.state();
+    bool regsDiffer = !sameRegs(r.regs, t.regs) || r.ime != t.ime || r.halted != t.halted || r.eiDelay != t.eiDelay;
+    bool cyclesDiffer = refCycles != 0 && refCycles != chunk.cycles;
+    bool countsDiffer = reference->cpu.instructions() != test->cpu.instructions();
+    bool writesDiffer = reference->writeHash != test->writeHash;
+
+    int ramDiff = -1;
+    int cartDiff = -1;
+    if (fullCompare || regsDiffer || cyclesDiffer || countsDiffer || writesDiffer) {
+        if (reference->RAM != test->RAM) {
+            for (int i = 0; i < (int) test->RAM.size(); i++) {
+                if (reference->RAM[i] != test->RAM[i]) {
+                    ramDiff = i;
+                    break;
+                }
+            }
+        }
+        // banked cartridge RAM lives outside RAM
+        const Cartridge& rc = reference->cartridge;
+        const Cartridge& tc = test->cartridge;
+        for (size_t i = 0; i < tc.ramSize() && i < rc.ramSize(); i++) {
+            if (rc.ram()[i] != tc.ram()[i]) {
+                cartDiff = (int) i;
+                break;
+            }
+        }
+    }
+    if (!regsDiffer && !cyclesDiffer && !countsDiffer && !writesDiffer && ramDiff < 0 && cartDiff < 0) return false;
+
+    printf("\nlockstep: divergence after %llu cycles (%llu chunks), in the chunk from PC 0x%04x at clock %llu\n",
+           (unsigned long long) totalCycles, (unsigned long long) chunks, chunk.pc, (unsigned long long) chunk.clock);
+    printf("  differs:%s%s%s%s%s%s\n", regsDiffer ? " registers" : "", cyclesDiffer ? " cycles" : "",
+           countsDiffer ? " instructions" : "", writesDiffer ? " writes" : "", ramDiff >= 0 ? " memory" : "",
+           cartDiff >= 0 ? " cartridge-RAM" : "");
+    printf("  cycles: reference %d, test %d\n", refCycles, chunk.cycles);
+    const CPU::State* sides[2] = {&r, &t};
+    const Bus* buses[2] = {reference.get(), test.get()};
+    for (int i = 0; i < 2; i++) {
+        printRegs(i ? "  test:      " : "  reference: ", sides[i]->regs);
+        printf(" IME %d HALT %d EI %d, %llu instructions, writes 0x%016llx\n", sides[i]->ime, sides[i]->halted,
+               sides[i]->eiDelay, (unsigned long long) buses[i]->cpu.instructions(),
+               (unsigned long long) buses[i]->writeHash);
+    }
+    if (ramDiff >= 0) {
+        printf("  memory: first difference at 0x%04x (reference 0x%02x, test 0x%02x)\n",
+               ramDiff, reference->RAM[ramDiff], test->RAM[ramDiff]);
+    }
+    if (cartDiff >= 0) {
+        printf("  cartridge RAM: first difference at offset 0x%05x (reference 0x%02x, test 0x%02x)\n",
+               cartDiff, reference->cartridge.ram()[cartDiff], test->cartridge.ram()[cartDiff]);
+    }
+    if (writesDiffer && ramDiff < 0 && cartDiff < 0) {
+        printf("  (same memory, different writes: a write went missing, came twice or went to I/O)\n");
+    }
+    printHistory();
+    return true;
+}
+
+void Lockstep::printHistory() const {
+    uint64_t first = stepCount > HISTORY ? stepCount - HISTORY : 0;
+    printf("  last %llu reference instructions (registers after):\n", (unsigned long long) (stepCount - first));
+    for (uint64_t i = first; i < stepCount; i++) {
+        const STEP& s = steps[i % HISTORY];
+        char opcode[8];
+        if (s.opcode == 0xCBu) snprintf(opcode, sizeof opcode, "cb %02x", s.cbOpcode);
+        else snprintf(opcode, sizeof opcode, "%02x", s.opcode);
+        printf("    %12llu  0x%04x  %-5s %-16s", (unsigned long long) s.clock, s.pc, opcode,
+               CPU::mnemonic(s.opcode, s.cbOpcode));
+        printRegs("", s.regs);
+        printf("\n");
+    }
+    first = chunkCount > HISTORY / 4 ? chunkCount - HISTORY / 4 : 0;
+    printf("  last %llu test chunks:\n", (unsigned long long) (chunkCount - first));
+    for (uint64_t i = first; i < chunkCount; i++) {
+        const CHUNK& c = testChunks[i % HISTORY];
+        printf("    %12llu  0x%04x  %d cycles, %llu instructions\n", (unsigned long long) c.clock, c.pc, c.cycles,
+               (unsigned long long) c.instructions);
+    }
+}
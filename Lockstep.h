@@ -0,0 +1,89 @@
+//
+// Differential execution of two CPU cores over the same ROM.
+//
+
+#ifndef NESEMULATOR_LOCKSTEP_H
+#define NESEMULATOR_LOCKSTEP_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "Bus.h"
+
+/**
+ * Runs the same ROM on two Buses side by side, a reference core and a test core (any two dispatch
+ * modes). The test core runs one Bus::runChunk (a run up to the next scheduled event), the reference
+ * core is single-stepped through its own scheduler until it reached the same clock, then the two are
+ * compared.
+ *
+ * The compare after every chunk is cheap enough for runs of millions of instructions: registers,
+ * IME/HALT state, cycles, retired instructions and a running hash of every write each CPU made
+ * (Bus::writeHash), which stands in for the memory. The memory itself (64KB plus cartridge RAM) is
+ * compared every FULL_COMPARE_CHUNKS chunks and at the end, to catch anything that changed it without a
+ * CPU write.
+ *
+ * `everyInstruction` makes the test side single-step as well, to find the exact instruction of a
+ * divergence (the block and JIT cores then interpret every instruction instead of running blocks).
+ *
+ * A divergence is reported with both sides' state, the last instructions the reference executed and
+ * the last chunks the test core ran.
+ */
+class Lockstep {
+public:
+    Lockstep(const std::string& romPath, bool skipBoot, CPU::DISPATCH_MODE referenceMode,
+             CPU::DISPATCH_MODE testMode, bool everyInstruction = false);
+
+    // Runs until maxCycles, the first divergence, or a HALT nothing can wake. Returns false on a divergence.
+    bool run(uint64_t maxCycles);
+
+    // "switch", "table", ... for a dispatch mode
+    static const char* coreName(CPU::DISPATCH_MODE mode);
+
+private:
+    // Without pending events a chunk could run forever; this also bounds how far apart two compares are
+    static const int MAX_CHUNK_CYCLES = 4096;
+    static const uint64_t FULL_COMPARE_CHUNKS = 256;
+
+    // An instruction the reference executed: where, and the registers after it
+    struct STEP {
+        uint64_t clock;
+        uint16_t pc;
+        uint8_t opcode;
+        uint8_t cbOpcode;
+        CPU::REGS regs;
+    };
+    // A chunk the test core ran
+    struct CHUNK {
+        uint64_t clock;
+        uint16_t pc;
+        int cycles;
+        uint64_t instructions;
+    };
+    static const size_t HISTORY = 32;
+
+    // Steps the reference up to the test side's clock, recording every instruction
+    void catchUpReference();
+    // Prints the first difference between the two sides; returns true if there is one.
+    // fullCompare: also compare all of memory.
+    bool diverged(const CHUNK& chunk, int refCycles, bool fullCompare);
+    void printHistory() const;
+
+    // Heap allocated: a Bus holds the whole address space plus the block cache
+    std::unique_ptr<Bus> reference;
+    std::unique_ptr<Bus> test;
+    CPU::DISPATCH_MODE referenceMode;
+    CPU::DISPATCH_MODE testMode;
+    bool everyInstruction;
+    uint64_t totalCycles = 0;
+    uint64_t chunks = 0;
+
+    // rings, the newest entry at (count - 1) % HISTORY
+    std::array<STEP, HISTORY> steps{};
+    uint64_t stepCount = 0;
+    std::array<CHUNK, HISTORY> testChunks{};
+    uint64_t chunkCount = 0;
+};
+
+
+#endif //NESEMULATOR_LOCKSTEP_H
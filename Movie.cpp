@@ -0,0 +1,240 @@
+//
+// Input movies (see Movie.h).
+//
+
+#include "Movie.h"
+#include "Bus.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+const char MAGIC[4] = {'G', 'B', 'M', 'V'};
+// M-cycles per runChunk call when running to a point: bounds the overshoot, not the speed
+const int RUN_SLICE = 1 << 16;
+
+uint64_t fnv1a(const uint8_t* data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+void put64(std::vector<uint8_t>& out, uint64_t value) {
+    for (int i = 0; i < 8; i++) out.push_back((uint8_t) (value >> (8 * i)));
+}
+
+void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80u) {
+        out.push_back((uint8_t) (value | 0x80u));
+        value >>= 7u;
+    }
+    out.push_back((uint8_t) value);
+}
+
+bool get64(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+    if (end - p < 8) return false;
+    value = 0;
+    for (int i = 0; i < 8; i++) value |= (uint64_t) p[i] << (8 * i);
+    p += 8;
+    return true;
+}
+
+bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        value |= (uint64_t) (b & 0x7Fu) << shift;
+        if (!(b & 0x80u)) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+uint64_t Movie::frames() const {
+    uint64_t total = 0;
+    for (const RUN& r : runs) total += r.frames;
+    return total;
+}
+
+bool Movie::save(const std::string& path) const {
+    std::vector<uint8_t> out(MAGIC, MAGIC + 4);
+    out.push_back((uint8_t) VERSION);
+    out.push_back(anchor);
+    out.push_back(skipBoot ? 1 : 0);
+    put64(out, romHash);
+    put64(out, frames());
+    put64(out, endHash);
+    putVarint(out, state.size());
+    out.insert(out.end(), state.begin(), state.end());
+    for (const RUN& r : runs) {
+        if (r.frames == 0) continue;
+        out.push_back(r.buttons);
+        putVarint(out, r.frames);
+    }
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+    return fclose(file) == 0 && written;
+}
+
+bool Movie::load(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    std::vector<uint8_t> data;
+    uint8_t buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof buffer, file)) > 0) data.insert(data.end(), buffer, buffer + n);
+    fclose(file);
+
+    const uint8_t* p = data.data();
+    const uint8_t* end = p + data.size();
+    if (data.size() < 7 || std::memcmp(p, MAGIC, 4) != 0 || p[4] != VERSION || p[5] > ANCHOR_STATE) return false;
+    Movie m;
+    m.anchor = (ANCHOR) p[5];
+    m.skipBoot = (p[6] & 1u) != 0;
+    p += 7;
+    uint64_t frameCount, stateSize;
+    if (!get64(p, end, m.romHash) || !get64(p, end, frameCount) || !get64(p, end, m.endHash) ||
+        !getVarint(p, end, stateSize) || stateSize > (uint64_t) (end - p)) {
+        return false;
+    }
+    m.state.assign(p, p + stateSize);
+    p += stateSize;
+    uint64_t total = 0;
+    while (p < end) {
+        RUN r;
+        r.buttons = *p++;
+        if (!getVarint(p, end, r.frames) || r.frames > frameCount - total) return false;
+        total += r.frames;
+        m.runs.push_back(r);
+    }
+    if (total != frameCount || (m.anchor == ANCHOR_STATE && m.state.empty())) return false;
+    *this = std::move(m);
+    return true;
+}
+
+uint64_t Movie::hashRom(const Cartridge& cartridge) {
+    return cartridge.loaded() ? fnv1a(cartridge.romData(), cartridge.romSize()) : 0;
+}
+
+uint64_t Movie::hashScreen(Bus& bus) {
+    bus.ppu.catchUp(bus.clock);
+    return fnv1a(bus.ppu.framebuffer(), PPU::WIDTH * PPU::HEIGHT);
+}
+
+MovieSession::~MovieSession() {
+    stop();
+}
+
+bool MovieSession::play(Bus& target, const Movie& movie) {
+    stop();
+    if (!target.cartridge.loaded() || Movie::hashRom(target.cartridge) != movie.romHash) return false;
+    if (movie.anchor == Movie::ANCHOR_STATE) {
+        if (!target.loadState(movie.state.data(), movie.state.size())) return false;
+    } else if (target.clock != 0) {
+        return false;
+    }
+    bus = &target;
+    playing = &movie;
+    bus->movie = this;
+    anchorClock = bus->clock;
+    bus->scheduler.cancel(Scheduler::EVENT_INPUT);
+    // run 0 holds from the anchor on, every later one starts with an EVENT_INPUT
+    run = 0;
+    runFrame = 0;
+    bus->setButtons(movie.runs.empty() ? 0 : movie.runs[0].buttons);
+    if (movie.runs.size() > 1) {
+        runFrame = movie.runs[0].frames;
+        bus->scheduler.schedule(Scheduler::EVENT_INPUT, frameStart(runFrame));
+    }
+    return true;
+}
+
+bool MovieSession::record(Bus& target, Movie& movie, bool skipBoot) {
+    stop();
+    if (!target.cartridge.loaded()) return false;
+    movie = Movie();
+    movie.romHash = Movie::hashRom(target.cartridge);
+    movie.skipBoot = skipBoot;
+    if (target.clock != 0) {
+        movie.anchor = Movie::ANCHOR_STATE;
+        target.saveState(movie.state);
+    }
+    movie.runs.push_back(Movie::RUN{target.buttons(), 0});
+    bus = &target;
+    recording = &movie;
+    bus->movie = this;
+    anchorClock = bus->clock;
+    bus->scheduler.cancel(Scheduler::EVENT_INPUT);
+    runFrame = 0;
+    pendingFrame = 0;
+    return true;
+}
+
+void MovieSession::press(uint8_t buttons) {
+    if (!recording) return;
+    // a change never lands in a frame that has started, and the last one before a frame start wins
+    pendingFrame = (bus->now() - anchorClock) / Movie::FRAME_CLOCKS + 1;
+    pendingButtons = buttons;
+    bus->scheduler.schedule(Scheduler::EVENT_INPUT, frameStart(pendingFrame));
+}
+
+void MovieSession::event() {
+    if (playing) {
+        run++;
+        bus->setButtons(playing->runs[run].buttons);
+        if (run + 1 < playing->runs.size()) {
+            runFrame += playing->runs[run].frames;
+            bus->scheduler.schedule(Scheduler::EVENT_INPUT, frameStart(runFrame));
+        }
+    } else if (recording && pendingFrame) {
+        if (pendingButtons != recording->runs.back().buttons) {
+            recording->runs.back().frames = pendingFrame - runFrame;
+            recording->runs.push_back(Movie::RUN{pendingButtons, 0});
+            runFrame = pendingFrame;
+        }
+        bus->setButtons(pendingButtons);
+        pendingFrame = 0;
+    }
+}
+
+void MovieSession::finish() {
+    if (!recording) return;
+    uint64_t total = (bus->clock - anchorClock) / Movie::FRAME_CLOCKS + 1;
+    // a change for the frame after the end isn't part of the movie
+    if (pendingFrame >= total) {
+        bus->scheduler.cancel(Scheduler::EVENT_INPUT);
+        pendingFrame = 0;
+    }
+    runTo(frameStart(total));
+    recording->runs.back().frames = total - runFrame;
+    recording->endHash = Movie::hashScreen(*bus);
+    stop();
+}
+
+uint64_t MovieSession::endClock() const {
+    return playing ? frameStart(playing->frames()) : anchorClock;
+}
+
+void MovieSession::stop() {
+    if (bus && bus->movie == this) {
+        bus->movie = nullptr;
+        bus->scheduler.cancel(Scheduler::EVENT_INPUT);
+    }
+    bus = nullptr;
+    playing = nullptr;
+    recording = nullptr;
+}
+
+bool MovieSession::runTo(uint64_t until) {
+    while (bus->clock < until) {
+        if (bus->haltedForever()) return false;
+        bus->runChunk((int) std::min<uint64_t>((until - bus->clock + 3) / 4, RUN_SLICE));
+    }
+    return true;
+}
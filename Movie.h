@@ -0,0 +1,113 @@
+//
+// Input movies: the joypad input of a run, frame by frame, for deterministic replay (see Bus::setButtons).
+//
+
+#ifndef NESEMULATOR_MOVIE_H
+#define NESEMULATOR_MOVIE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Bus;
+class Cartridge;
+
+/**
+ * A movie is the buttons held in every frame (one byte per frame, Bus::BUTTON bits) since an anchor:
+ * power on (with or without the boot ROM) or a save state stored in the movie. It is bound to the ROM
+ * it was recorded with by a hash of the whole ROM, and remembers a hash of the screen at its end so a
+ * replay can tell whether it came out the same.
+ *
+ * Frames are counted in clock time, FRAME_CLOCKS from the anchor each (LCD on or not), so they don't
+ * depend on what the PPU does. Input only changes at a frame start.
+ *
+ * File layout (integers little endian, varints LEB128): "GBMV", version (u8), anchor (u8),
+ * flags (u8, bit 0: boot ROM skipped), ROM hash (u64), frames (u64), end screen hash (u64, 0 if
+ * unknown), save state length (varint) and bytes, then the frames run length encoded as
+ * (buttons (u8), frames (varint)) pairs.
+ */
+class Movie {
+public:
+    static const uint64_t FRAME_CLOCKS = 70224;
+    static const uint8_t VERSION = 1;
+
+    enum ANCHOR : uint8_t {
+        ANCHOR_POWER_ON = 0,
+        ANCHOR_STATE = 1,
+    };
+    struct RUN {
+        uint8_t buttons;
+        uint64_t frames;
+    };
+
+    ANCHOR anchor = ANCHOR_POWER_ON;
+    bool skipBoot = true;
+    uint64_t romHash = 0;
+    uint64_t endHash = 0;
+    std::vector<uint8_t> state; // ANCHOR_STATE: the save state it starts from
+    std::vector<RUN> runs;
+
+    uint64_t frames() const;
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+    // FNV-1a of the whole ROM / of the screen (after drawing what the PPU still owes)
+    static uint64_t hashRom(const Cartridge& cartridge);
+    static uint64_t hashScreen(Bus& bus);
+};
+
+/**
+ * Plays a movie back on a Bus, or records one from it. Only input changes cost anything: the next one
+ * is scheduled as the Bus's EVENT_INPUT, so a replay runs at full speed with no per-frame work.
+ */
+class MovieSession {
+public:
+    MovieSession() = default;
+    ~MovieSession();
+    MovieSession(const MovieSession&) = delete;
+    MovieSession& operator=(const MovieSession&) = delete;
+
+    // Starts playing `movie` (which must outlive the session) on `bus`. A power-on movie needs a bus fresh
+    // out of init (with movie.skipBoot), a save state one any bus with the ROM loaded. False if the
+    // movie doesn't fit the bus.
+    bool play(Bus& bus, const Movie& movie);
+    // Starts recording into `movie` from where `bus` is: power on if it hasn't run yet (skipBoot: how it
+    // was initialized), otherwise a save state of it.
+    bool record(Bus& bus, Movie& movie, bool skipBoot);
+    // Recording: the buttons held from the next frame on
+    void press(uint8_t buttons);
+    // Recording: runs to the end of the current frame and completes the movie (length, end screen hash)
+    void finish();
+    // Runs the bus to the start of `frame` (counted from the anchor). False if it stopped early (a HALT
+    // nothing can wake).
+    bool runToFrame(uint64_t frame) { return bus && runTo(frameStart(frame)); }
+    // Playback: runs to the end of the movie
+    bool runToEnd() { return playing && runToFrame(playing->frames()); }
+    // Playback: where the movie ends
+    uint64_t endClock() const;
+    // Detaches from the bus
+    void stop();
+
+    // EVENT_INPUT (Bus::handleEvent)
+    void event();
+
+private:
+    uint64_t frameStart(uint64_t frame) const { return anchorClock + frame * Movie::FRAME_CLOCKS; }
+    // Runs `bus` to the first instruction boundary at or after `until`; false if it halted for good first
+    bool runTo(uint64_t until);
+
+    Bus* bus = nullptr;
+    const Movie* playing = nullptr;
+    Movie* recording = nullptr;
+    uint64_t anchorClock = 0;
+    // playback: the run applied last; recording: the frame the last run starts at
+    size_t run = 0;
+    uint64_t runFrame = 0;
+    // recording: the change waiting for its frame
+    uint64_t pendingFrame = 0;
+    uint8_t pendingButtons = 0;
+};
+
+
+#endif //NESEMULATOR_MOVIE_H
@@ -0,0 +1,56 @@
+//
+// Compile-time opcode dispatch tables for the CPU.
+//
+
+#ifndef NESEMULATOR_OPCODETABLE_H
+#define NESEMULATOR_OPCODETABLE_H
+
+#include "CPU.h"
+
+/**
+ * Both tables are generated from Opcodes.inc (scripts/OPCODE_gen.py), which in turn is
+ * generated from the reference switch in CPU::stepSwitch, so the two cores can't drift apart.
+ * NOTE: only include this from translation units that implement CPU members.
+ */
+struct CPU::OpcodeTable {
+    static constexpr INSTRUCTION lookup[256] = {
+#define OP(code, length, cycles, name, expr) {&CPU::invoke<&CPU::OP_##code>, cycles, length},
+#include "Opcodes.inc"
+#undef OP
+    };
+
+    static constexpr INSTRUCTION lookupCB[256] = {
+#define CB_OP(code, length, cycles, name, expr) {&CPU::invoke<&CPU::CB_##code>, cycles, length},
+#include "Opcodes.inc"
+#undef CB_OP
+    };
+
+    // Pre-decoded handlers for the block core: operands come from the MicroOp instead of the Bus
+    static constexpr int (*decoded[256])(CPU&, uint16_t) = {
+#define OP(code, length, cycles, name, expr) &CPU::invokeDecoded<&CPU::DOP_##code>,
+#include "Opcodes.inc"
+#undef OP
+    };
+
+    static constexpr int (*decodedCB[256])(CPU&, uint16_t) = {
+#define CB_OP(code, length, cycles, name, expr) &CPU::invokeDecoded<&CPU::DCB_##code>,
+#include "Opcodes.inc"
+#undef CB_OP
+    };
+
+    // Mnemonics, kept out of the hot tables
+    static constexpr const char* names[256] = {
+#define OP(code, length, cycles, name, expr) name,
+#include "Opcodes.inc"
+#undef OP
+    };
+
+    static constexpr const char* namesCB[256] = {
+#define CB_OP(code, length, cycles, name, expr) name,
+#include "Opcodes.inc"
+#undef CB_OP
+    };
+};
+
+
+#endif //NESEMULATOR_OPCODETABLE_H
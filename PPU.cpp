@@ -0,0 +1,244 @@
+//
+// DMG picture processing unit (see PPU.h).
+//
+
+#include "PPU.h"
+#include <algorithm>
+#include <cstring>
+
+// LCD registers
+#define LCDC 0xFF40u
+#define STAT 0xFF41u
+#define SCY 0xFF42u
+#define SCX 0xFF43u
+#define LY 0xFF44u
+#define LYC 0xFF45u
+#define BGP 0xFF47u
+#define OBP0 0xFF48u
+#define OBP1 0xFF49u
+#define WY 0xFF4Au
+#define WX 0xFF4Bu
+#define OAM 0xFE00u
+
+// Interrupt request bits in IF
+#define VBLANK_RQ 0x01u
+#define LCD_STAT_RQ 0x02u
+
+// Dots into a line at which modes 3 and 0 start (mode 2 starts at 0)
+#define DRAW_START 80
+#define HBLANK_START 252
+
+void PPU::reset(uint64_t now) {
+    onTime = now;
+    frameIndex = 0;
+    renderedLines = 0;
+    windowLine = 0;
+    updateStatus(now);
+    schedule(now);
+}
+
+int PPU::modeAt(int pos) {
+    if (pos >= HEIGHT * LINE_CLOCKS) return 1;
+    int dot = pos % LINE_CLOCKS;
+    return dot < DRAW_START ? 2 : dot < HBLANK_START ? 3 : 0;
+}
+
+void PPU::catchUp(uint64_t now) {
+    if (!lcdOn() || now <= onTime) return;
+    uint64_t elapsed = now - onTime;
+    uint64_t f = elapsed / FRAME_CLOCKS;
+    int pos = (int) (elapsed % FRAME_CLOCKS);
+    if (f != frameIndex) {
+        // finish the frame we were in; frames in between were drawn from the same state, so they
+        // would look exactly like it
+        if (renderedLines < HEIGHT) {
+            while (renderedLines < HEIGHT) renderLine(renderedLines++);
+            frameCount++;
+        }
+        frameCount += f - frameIndex - 1;
+        frameIndex = f;
+        renderedLines = 0;
+        windowLine = 0;
+    }
+    int done = pos < HBLANK_START ? 0 : std::min((pos - HBLANK_START) / LINE_CLOCKS + 1, HEIGHT);
+    while (renderedLines < done) {
+        renderLine(renderedLines++);
+        // the frame counts as complete once its last line is drawn (at VBlank)
+        if (renderedLines == HEIGHT) frameCount++;
+    }
+}
+
+void PPU::updateStatus(uint64_t now) {
+    int line = 0, mode = 0;
+    if (lcdOn()) {
+        int pos = framePos(now);
+        line = pos / LINE_CLOCKS;
+        mode = modeAt(pos);
+    }
+    mem[LY] = (uint8_t) line;
+    uint8_t coincidence = mem[LYC] == line ? 0x04u : 0x00u;
+    mem[STAT] = (uint8_t) (0x80u | (mem[STAT] & 0x78u) | coincidence | mode);
+}
+
+bool PPU::statLine(uint64_t t) const {
+    if (!lcdOn() || t < onTime) return false;
+    uint8_t stat = mem[STAT];
+    int pos = framePos(t);
+    int mode = modeAt(pos);
+    return (mode == 0 && (stat & 0x08u)) || (mode == 1 && (stat & 0x10u)) || (mode == 2 && (stat & 0x20u)) ||
+           (pos / LINE_CLOCKS == mem[LYC] && (stat & 0x40u));
+}
+
+uint64_t PPU::nextLineDot(uint64_t t, int dot, int first, int last) const {
+    uint64_t elapsed = t - onTime;
+    uint64_t frameStart = onTime + elapsed / FRAME_CLOCKS * FRAME_CLOCKS;
+    int pos = (int) (elapsed % FRAME_CLOCKS);
+    // first line whose `dot` still lies ahead
+    int line = pos < dot ? 0 : (pos - dot) / LINE_CLOCKS + 1;
+    line = std::max(line, first);
+    if (line <= last) return frameStart + (uint64_t) line * LINE_CLOCKS + dot;
+    return frameStart + FRAME_CLOCKS + (uint64_t) first * LINE_CLOCKS + dot;
+}
+
+void PPU::schedule(uint64_t now) {
+    if (!lcdOn()) {
+        pending = UINT64_MAX;
+        return;
+    }
+    // VBlank (also the mode 1 STAT source)
+    uint64_t next = nextLineDot(now, 0, HEIGHT, HEIGHT);
+    uint8_t stat = mem[STAT];
+    if (stat & 0x08u) next = std::min(next, nextLineDot(now, HBLANK_START, 0, HEIGHT - 1));
+    if (stat & 0x20u) next = std::min(next, nextLineDot(now, 0, 0, HEIGHT - 1));
+    if ((stat & 0x40u) && mem[LYC] < LINES) next = std::min(next, nextLineDot(now, 0, mem[LYC], mem[LYC]));
+    pending = next;
+}
+
+uint8_t PPU::event() {
+    uint64_t t = pending;
+    catchUp(t);
+    updateStatus(t);
+    uint8_t irq = 0;
+    if (framePos(t) == HEIGHT * LINE_CLOCKS) irq |= VBLANK_RQ;
+    if (statLine(t) && !statLine(t - 1)) irq |= LCD_STAT_RQ;
+    schedule(t);
+    return irq;
+}
+
+uint8_t PPU::write(uint16_t addr, uint8_t data, uint64_t now) {
+    bool before = statLine(now);
+    switch (addr) {
+        case LCDC:
+            if (!lcdOn() && (data & 0x80u)) {
+                // a frame starts over whenever the LCD is switched on
+                mem[LCDC] = data;
+                reset(now);
+                return 0;
+            }
+            mem[LCDC] = data;
+            break;
+        case STAT:
+            // the mode and coincidence bits are read only
+            mem[STAT] = (uint8_t) ((mem[STAT] & 0x07u) | (data & 0x78u) | 0x80u);
+            break;
+        case LY:
+            return 0;
+        default:
+            mem[addr] = data;
+            break;
+    }
+    updateStatus(now);
+    schedule(now);
+    // enabling a source (or moving LYC onto LY) while its condition holds raises the line right away
+    return !before && statLine(now) ? LCD_STAT_RQ : 0;
+}
+
+void PPU::restore(const State& s, const uint8_t* pixels) {
+    onTime = s.onTime;
+    pending = s.pending;
+    frameIndex = s.frameIndex;
+    frameCount = s.frameCount;
+    renderedLines = s.renderedLines;
+    windowLine = s.windowLine;
+    std::memcpy(frame.data(), pixels, frame.size());
+    // VRAM came along with the rest of memory
+    dirty.fill(true);
+}
+
+const uint8_t* PPU::tileRow(int tile, int row) const {
+    auto& pixels = tiles[tile];
+    if (dirty[tile]) {
+        kernels->decodeRows(mem + 0x8000u + tile * 16, 8, pixels.data());
+        dirty[tile] = false;
+    }
+    return pixels.data() + row * 8;
+}
+
+void PPU::renderTiles(uint8_t* dst, int from, int to, uint16_t map, int y, int xOffset) const {
+    bool unsignedTiles = (mem[LCDC] & 0x10u) != 0;
+    const uint8_t* mapRow = mem + map + (y >> 3) * 32;
+    int x = from;
+    while (x < to) {
+        int mapX = (x + xOffset) & 0xFF;
+        int fine = mapX & 7;
+        uint8_t index = mapRow[mapX >> 3];
+        // 0x8000 addressing, or signed indices around 0x9000
+        int tile = unsignedTiles ? index : 256 + (int8_t) index;
+        int n = std::min(8 - fine, to - x);
+        std::memcpy(dst + x, tileRow(tile, y & 7) + fine, n);
+        x += n;
+    }
+}
+
+void PPU::renderSprites(int ly, const uint8_t* color, uint8_t* out) const {
+    int height = (mem[LCDC] & 0x04u) ? 16 : 8;
+    // OAM scan: the first 10 sprites covering the line
+    int found[10];
+    int count = 0;
+    for (int i = 0; i < 40 && count < 10; i++) {
+        int y = mem[OAM + i * 4] - 16;
+        if (ly >= y && ly < y + height) found[count++] = i;
+    }
+    // DMG priority: smaller X first, then lower OAM index
+    std::stable_sort(found, found + count, [this](int a, int b) { return mem[OAM + a * 4 + 1] < mem[OAM + b * 4 + 1]; });
+
+    // a pixel belongs to the highest priority opaque sprite, even if the BG then hides it
+    bool taken[WIDTH] = {};
+    for (int k = 0; k < count; k++) {
+        const uint8_t* sprite = mem + OAM + found[k] * 4;
+        int x = sprite[1] - 8;
+        uint8_t attr = sprite[3];
+        int row = ly - (sprite[0] - 16);
+        if (attr & 0x40u) row = height - 1 - row;
+        int tile = height == 16 ? (sprite[2] & 0xFEu) | (row >> 3) : sprite[2];
+        const uint8_t* pixels = tileRow(tile, row & 7);
+        uint8_t palette = mem[(attr & 0x10u) ? OBP1 : OBP0];
+        for (int p = 0; p < 8; p++) {
+            int sx = x + p;
+            if (sx < 0 || sx >= WIDTH || taken[sx]) continue;
+            uint8_t c = pixels[(attr & 0x20u) ? 7 - p : p];
+            if (!c) continue;
+            taken[sx] = true;
+            if ((attr & 0x80u) && color[sx]) continue;
+            out[sx] = (uint8_t) ((palette >> (c * 2)) & 3u);
+        }
+    }
+}
+
+void PPU::renderLine(int ly) {
+    uint8_t lcdc = mem[LCDC];
+    uint8_t color[WIDTH];
+    uint8_t* out = frame.data() + ly * WIDTH;
+    if (lcdc & 0x01u) {
+        renderTiles(color, 0, WIDTH, (lcdc & 0x08u) ? 0x9C00u : 0x9800u, (ly + mem[SCY]) & 0xFF, mem[SCX]);
+        int wx = mem[WX] - 7;
+        if ((lcdc & 0x20u) && ly >= mem[WY] && wx < WIDTH) {
+            renderTiles(color, std::max(wx, 0), WIDTH, (lcdc & 0x40u) ? 0x9C00u : 0x9800u, windowLine, -wx);
+            windowLine++;
+        }
+    } else {
+        std::memset(color, 0, sizeof(color));
+    }
+    kernels->applyPalette(color, WIDTH, mem[BGP], out);
+    if (lcdc & 0x02u) renderSprites(ly, color, out);
+}
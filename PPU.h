@@ -0,0 +1,104 @@
+//
+// DMG picture processing unit: scanline renderer with a pre-decoded tile cache (see Bus::syncPpu).
+//
+
+#ifndef NESEMULATOR_PPU_H
+#define NESEMULATOR_PPU_H
+
+#include <array>
+#include <cstdint>
+#include "PixelKernels.h"
+
+/**
+ * Timing: with the LCD on, a frame is 154 lines of 456 clocks. Lines 0-143 go through
+ * mode 2 (OAM scan, 80 clocks), mode 3 (drawing, 172) and mode 0 (HBlank, 204); lines 144-153
+ * are mode 1 (VBlank). LY, the STAT mode and the LY=LYC flag are all functions of the time since
+ * the LCD was switched on, so they are computed when read instead of being stepped.
+ *
+ * Rendering is lazy as well: a line is drawn once its HBlank started and somebody needs it, i.e. before
+ * anything it was drawn from (VRAM, OAM, LCD registers) changes and when the frame ends. Since
+ * every such change goes through the Bus first, each line sees the same state it would have seen on
+ * hardware at that point (at line granularity).
+ *
+ * The only scheduled work is for interrupts: VBlank, and the STAT sources enabled in STAT.
+ */
+class PPU {
+public:
+    static const int WIDTH = 160;
+    static const int HEIGHT = 144;
+    static const int LINE_CLOCKS = 456;
+    static const int LINES = 154;
+    static const int FRAME_CLOCKS = LINE_CLOCKS * LINES;
+
+    // mem points at the whole address space (VRAM, OAM and the LCD registers are read from there)
+    explicit PPU(uint8_t* mem) : mem(mem) { dirty.fill(true); }
+
+    // Starts over from the LCD registers as they are at time `now`
+    void reset(uint64_t now);
+    // Draws every line whose HBlank started before `now`. Call before VRAM/OAM/LCD registers change.
+    void catchUp(uint64_t now);
+    // LCD register write (0xFF40-0xFF4B, after catchUp). Returns the interrupt requests it raised.
+    uint8_t write(uint16_t addr, uint8_t data, uint64_t now);
+    // A byte of tile data (0x8000-0x97FF) changed
+    void tileWritten(uint16_t addr) { dirty[(addr - 0x8000u) >> 4u] = true; }
+    // Stores LY and the STAT mode/coincidence bits as they are at `now`
+    void updateStatus(uint64_t now);
+
+    // Time of the next interrupt the PPU may raise, UINT64_MAX while the LCD is off
+    uint64_t nextEvent() const { return pending; }
+    // Handles the event at nextEvent() and works out the one after. Returns the interrupt requests raised.
+    uint8_t event();
+
+    // 2-bit shades (0 = white), WIDTH x HEIGHT
+    const uint8_t* framebuffer() const { return frame.data(); }
+    // frames completed since power on
+    uint64_t frames() const { return frameCount; }
+
+    // Save state view (the registers are in memory, the frame buffer goes along separately)
+    struct State {
+        uint64_t onTime;
+        uint64_t pending;
+        uint64_t frameIndex;
+        uint64_t frameCount;
+        int32_t renderedLines;
+        int32_t windowLine;
+    };
+    State state() const { return State{onTime, pending, frameIndex, frameCount, renderedLines, windowLine}; }
+    // frame: WIDTH x HEIGHT shades as returned by framebuffer()
+    void restore(const State& s, const uint8_t* frame);
+
+private:
+    bool lcdOn() const { return (mem[0xFF40u] & 0x80u) != 0; }
+    // clocks into the current frame at time t (t >= onTime)
+    int framePos(uint64_t t) const { return (int) ((t - onTime) % FRAME_CLOCKS); }
+    static int modeAt(int pos);
+    // the OR of all enabled STAT sources at time t; interrupts fire on its rising edges
+    bool statLine(uint64_t t) const;
+    // earliest time after t at which a line in [first, last] reaches dot `dot`
+    uint64_t nextLineDot(uint64_t t, int dot, int first, int last) const;
+    void schedule(uint64_t now);
+
+    void renderLine(int ly);
+    // BG/window tile row pixels for x in [from, to) into the color index buffer
+    void renderTiles(uint8_t* dst, int from, int to, uint16_t map, int y, int xOffset) const;
+    void renderSprites(int ly, const uint8_t* color, uint8_t* out) const;
+    // 8 color indices of row `row` of tile `tile` (0-383: 0x8000, 0x8800, 0x9000 blocks)
+    const uint8_t* tileRow(int tile, int row) const;
+
+    uint8_t* mem;
+    const PixelKernels* kernels = &PixelKernels::best();  // tile decoding and BG palette mapping
+    uint64_t onTime = 0;              // when the LCD was switched on
+    uint64_t pending = UINT64_MAX;    // see nextEvent
+    uint64_t frameIndex = 0;          // frame (since onTime) renderedLines refers to
+    int renderedLines = 0;            // lines of that frame drawn so far
+    int windowLine = 0;               // internal window line counter of that frame
+    uint64_t frameCount = 0;
+
+    std::array<uint8_t, WIDTH * HEIGHT> frame{};
+    // 2bpp tiles decoded to one color index per byte, re-decoded on use after a write
+    mutable std::array<std::array<uint8_t, 64>, 384> tiles{};
+    mutable std::array<bool, 384> dirty{};
+};
+
+
+#endif //NESEMULATOR_PPU_H
@@ -0,0 +1,188 @@
+//
+// 2bpp tile decoding and palette mapping kernels (see PixelKernels.h).
+//
+
+#include "PixelKernels.h"
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_SIMD 1
+#include <immintrin.h>
+#else
+#define PIXEL_SIMD 0
+#endif
+
+namespace {
+
+void decodeRow(uint8_t lo, uint8_t hi, uint8_t* out) {
+    for (int x = 0; x < 8; x++) {
+        out[x] = (uint8_t) ((((hi >> (7 - x)) & 1u) << 1u) | ((lo >> (7 - x)) & 1u));
+    }
+}
+
+void decodeRowsScalar(const uint8_t* data, int rows, uint8_t* out) {
+    for (int r = 0; r < rows; r++) decodeRow(data[2 * r], data[2 * r + 1], out + r * 8);
+}
+
+void applyPaletteScalar(const uint8_t* colors, int count, uint8_t palette, uint8_t* out) {
+    const uint8_t shades[4] = {(uint8_t) (palette & 3u), (uint8_t) ((palette >> 2) & 3u),
+                               (uint8_t) ((palette >> 4) & 3u), (uint8_t) (palette >> 6)};
+    for (int i = 0; i < count; i++) out[i] = shades[colors[i]];
+}
+
+#if PIXEL_SIMD
+
+/*
+ * Both decoders broadcast each plane byte over the 8 lanes of its row, then test one bit per lane
+ * (pixel 0 = bit 7) with an AND + compare against the same mask, which leaves 0xFF where the bit is set.
+ */
+
+// the bit of pixel 0-7 in lanes 0-7 (little endian)
+const long long PIXEL_BITS = 0x0102040810204080ll;
+
+__attribute__((target("sse2")))
+void decodeRowsSse2(const uint8_t* data, int rows, uint8_t* out) {
+    const __m128i bits = _mm_set1_epi64x(PIXEL_BITS);
+    // low plane lanes count 1, high plane lanes 2
+    const __m128i weights = _mm_setr_epi8(1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+    const __m128i lowBytes = _mm_set1_epi16(0xFF);
+    int r = 0;
+    for (; r + 8 <= rows; r += 8) {
+        // a whole tile: split the planes (lo0..lo7, hi0..hi7), then spread each byte over its row
+        __m128i v = _mm_loadu_si128((const __m128i*) (data + 2 * r));
+        __m128i planes = _mm_packus_epi16(_mm_and_si128(v, lowBytes), _mm_srli_epi16(v, 8));
+        __m128i lo = _mm_unpacklo_epi8(planes, planes), hi = _mm_unpackhi_epi8(planes, planes);
+        __m128i lo03 = _mm_unpacklo_epi16(lo, lo), lo47 = _mm_unpackhi_epi16(lo, lo);
+        __m128i hi03 = _mm_unpacklo_epi16(hi, hi), hi47 = _mm_unpackhi_epi16(hi, hi);
+        // each register holds two rows of one plane
+        const __m128i loRows[4] = {_mm_unpacklo_epi32(lo03, lo03), _mm_unpackhi_epi32(lo03, lo03),
+                                   _mm_unpacklo_epi32(lo47, lo47), _mm_unpackhi_epi32(lo47, lo47)};
+        const __m128i hiRows[4] = {_mm_unpacklo_epi32(hi03, hi03), _mm_unpackhi_epi32(hi03, hi03),
+                                   _mm_unpacklo_epi32(hi47, hi47), _mm_unpackhi_epi32(hi47, hi47)};
+        for (int k = 0; k < 4; k++) {
+            __m128i l = loRows[k], h = hiRows[k];
+            l = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(l, bits), bits), one);
+            h = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(h, bits), bits), two);
+            _mm_storeu_si128((__m128i*) (out + (r + 2 * k) * 8), _mm_or_si128(l, h));
+        }
+    }
+    for (; r + 2 <= rows; r += 2) {
+        uint32_t pair;
+        std::memcpy(&pair, data + 2 * r, 4);
+        // lo0 hi0 lo1 hi1 -> lo0 x4, hi0 x4, lo1 x4, hi1 x4
+        __m128i v = _mm_cvtsi32_si128((int) pair);
+        v = _mm_unpacklo_epi8(v, v);
+        v = _mm_unpacklo_epi16(v, v);
+        __m128i planes0 = _mm_unpacklo_epi32(v, v);  // lo0 x8, hi0 x8
+        __m128i planes1 = _mm_unpackhi_epi32(v, v);  // lo1 x8, hi1 x8
+        planes0 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(planes0, bits), bits), weights);
+        planes1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(planes1, bits), bits), weights);
+        // fold the high plane half onto the low one
+        __m128i row0 = _mm_add_epi8(planes0, _mm_srli_si128(planes0, 8));
+        __m128i row1 = _mm_add_epi8(planes1, _mm_srli_si128(planes1, 8));
+        _mm_storeu_si128((__m128i*) (out + r * 8), _mm_unpacklo_epi64(row0, row1));
+    }
+    if (r < rows) decodeRow(data[2 * r], data[2 * r + 1], out + r * 8);
+}
+
+__attribute__((target("sse2")))
+void applyPaletteSse2(const uint8_t* colors, int count, uint8_t palette, uint8_t* out) {
+    // no byte shuffle before SSSE3: select each shade with a compare per color
+    __m128i shade[4], color[4];
+    for (int c = 0; c < 4; c++) {
+        shade[c] = _mm_set1_epi8((char) ((palette >> (c * 2)) & 3u));
+        color[c] = _mm_set1_epi8((char) c);
+    }
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (colors + i));
+        __m128i result = _mm_and_si128(_mm_cmpeq_epi8(v, color[0]), shade[0]);
+        for (int c = 1; c < 4; c++) {
+            result = _mm_or_si128(result, _mm_and_si128(_mm_cmpeq_epi8(v, color[c]), shade[c]));
+        }
+        _mm_storeu_si128((__m128i*) (out + i), result);
+    }
+    applyPaletteScalar(colors + i, count - i, palette, out + i);
+}
+
+__attribute__((target("avx2")))
+void decodeRowsAvx2(const uint8_t* data, int rows, uint8_t* out) {
+    const __m256i bits = _mm256_set1_epi64x(PIXEL_BITS);
+    // vpshufb stays within 128-bit halves: rows 0-1 come from the low copy of the 4 row pairs, rows 2-3 from the high
+    const __m256i loPlanes = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 2,
+                                              4, 4, 4, 4, 4, 4, 4, 4, 6, 6, 6, 6, 6, 6, 6, 6);
+    const __m256i hiPlanes = _mm256_setr_epi8(1, 1, 1, 1, 1, 1, 1, 1, 3, 3, 3, 3, 3, 3, 3, 3,
+                                              5, 5, 5, 5, 5, 5, 5, 5, 7, 7, 7, 7, 7, 7, 7, 7);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    int r = 0;
+    for (; r + 4 <= rows; r += 4) {
+        __m256i v = _mm256_broadcastsi128_si256(_mm_loadl_epi64((const __m128i*) (data + 2 * r)));
+        __m256i lo = _mm256_shuffle_epi8(v, loPlanes);
+        __m256i hi = _mm256_shuffle_epi8(v, hiPlanes);
+        lo = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits), one);
+        hi = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits), two);
+        _mm256_storeu_si256((__m256i*) (out + r * 8), _mm256_or_si256(lo, hi));
+    }
+    for (; r < rows; r++) decodeRow(data[2 * r], data[2 * r + 1], out + r * 8);
+}
+
+__attribute__((target("avx2")))
+void applyPaletteAvx2(const uint8_t* colors, int count, uint8_t palette, uint8_t* out) {
+    // the palette is a 4 entry lookup table, which vpshufb does 32 at a time
+    __m128i table = _mm_setr_epi8((char) (palette & 3u), (char) ((palette >> 2) & 3u), (char) ((palette >> 4) & 3u),
+                                  (char) (palette >> 6), 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m256i lut = _mm256_broadcastsi128_si256(table);
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (colors + i));
+        _mm256_storeu_si256((__m256i*) (out + i), _mm256_shuffle_epi8(lut, v));
+    }
+    applyPaletteScalar(colors + i, count - i, palette, out + i);
+}
+
+#endif
+
+const PixelKernels KERNELS[PixelKernels::ISA_COUNT] = {
+        {"scalar", decodeRowsScalar, applyPaletteScalar},
+#if PIXEL_SIMD
+        {"sse2", decodeRowsSse2, applyPaletteSse2},
+        {"avx2", decodeRowsAvx2, applyPaletteAvx2},
+#else
+        {"sse2", nullptr, nullptr},
+        {"avx2", nullptr, nullptr},
+#endif
+};
+
+bool hostSupports(PixelKernels::ISA isa) {
+#if PIXEL_SIMD
+    __builtin_cpu_init();
+    switch (isa) {
+        case PixelKernels::ISA_SCALAR: return true;
+        case PixelKernels::ISA_SSE2: return __builtin_cpu_supports("sse2");
+        case PixelKernels::ISA_AVX2: return __builtin_cpu_supports("avx2");
+        default: return false;
+    }
+#else
+    return isa == PixelKernels::ISA_SCALAR;
+#endif
+}
+
+} // namespace
+
+const PixelKernels* PixelKernels::get(ISA isa) {
+    if (isa < 0 || isa >= ISA_COUNT || !hostSupports(isa)) return nullptr;
+    return &KERNELS[isa];
+}
+
+const PixelKernels& PixelKernels::best() {
+    static const PixelKernels* chosen = [] {
+        for (int isa = ISA_COUNT - 1; isa > ISA_SCALAR; isa--) {
+            if (const PixelKernels* kernels = get((ISA) isa)) return kernels;
+        }
+        return &KERNELS[ISA_SCALAR];
+    }();
+    return *chosen;
+}
@@ -0,0 +1,34 @@
+//
+// 2bpp tile decoding and palette mapping kernels for the PPU, picked at runtime by CPU feature.
+//
+
+#ifndef NESEMULATOR_PIXELKERNELS_H
+#define NESEMULATOR_PIXELKERNELS_H
+
+#include <cstdint>
+
+/**
+ * A tile row is two bytes in VRAM: the low bit-plane, then the high bit-plane, pixel 0 in bit 7.
+ * decodeRows turns `rows` such pairs (a whole tile, or the rows a scanline fetched from several tiles)
+ * into one color index (0-3) per byte, 8 per row. applyPalette maps color indices to 2-bit shades
+ * through a BGP/OBP0/OBP1 style palette byte (shade of color c in bits 2c+1..2c).
+ *
+ * Every kernel set produces exactly the same output as the scalar one; the SSE2 and AVX2 sets are only
+ * compiled on x86 GCC/Clang builds (with per-function target attributes, so the rest of the core is
+ * not built for AVX2) and only handed out when the host CPU has the instructions.
+ */
+struct PixelKernels {
+    enum ISA { ISA_SCALAR = 0, ISA_SSE2, ISA_AVX2, ISA_COUNT };
+
+    const char* name;
+    void (*decodeRows)(const uint8_t* data, int rows, uint8_t* out);
+    void (*applyPalette)(const uint8_t* colors, int count, uint8_t palette, uint8_t* out);
+
+    // nullptr if the set isn't compiled in or the host CPU can't run it
+    static const PixelKernels* get(ISA isa);
+    // fastest set the host can run (detected once)
+    static const PixelKernels& best();
+};
+
+
+#endif //NESEMULATOR_PIXELKERNELS_H
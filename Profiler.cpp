@@ -0,0 +1,92 @@
+//
+// Execution profile report (see Profiler.h).
+//
+
+#include "Profiler.h"
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+// rows per section of the report
+const int TOP_OPCODES = 32;
+const int TOP_CB_OPCODES = 16;
+const int TOP_ADDRESSES = 32;
+
+} // namespace
+
+Profiler::Profiler() : pcHits(0x10000) {
+    readCost = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t start = now();
+        readCost = std::min(readCost, now() - start);
+    }
+    reset();
+}
+
+void Profiler::reset() {
+    opcodes.fill(STATS{});
+    cbOpcodes.fill(STATS{});
+    std::fill(pcHits.begin(), pcHits.end(), 0);
+    startTicks = now();
+    startTime = std::chrono::steady_clock::now();
+}
+
+uint64_t Profiler::instructions(bool prefixedOnly) const {
+    uint64_t count = 0;
+    for (const STATS& s : cbOpcodes) count += s.count;
+    if (!prefixedOnly) {
+        for (const STATS& s : opcodes) count += s.count;
+    }
+    return count;
+}
+
+void Profiler::reportOpcodes(FILE* out, const char* title, const std::array<STATS, 256>& table,
+                             const char* const* names, const char* prefix, uint64_t total, double nsPerTick) const {
+    std::vector<int> order(256);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&table](int a, int b) {
+        return table[a].ticks != table[b].ticks ? table[a].ticks > table[b].ticks : table[a].count > table[b].count;
+    });
+    // handler time without the clock reads
+    auto netTicks = [this](const STATS& s) { return s.ticks > s.count * readCost ? s.ticks - s.count * readCost : 0; };
+    uint64_t ticks = 0, count = 0;
+    for (const STATS& s : table) {
+        ticks += netTicks(s);
+        count += s.count;
+    }
+    if (count == 0) return;
+    int rows = prefix[0] ? TOP_CB_OPCODES : TOP_OPCODES;
+    fprintf(out, "\n%s (%llu executed, %.3f ms)\n", title, (unsigned long long) count, ticks * nsPerTick / 1e6);
+    fprintf(out, "  %6s %6s %14s %8s  %s\n", "%time", "%exec", "executions", "ns/op", "opcode");
+    for (int i = 0; i < rows && table[order[i]].count; i++) {
+        const STATS& s = table[order[i]];
+        uint64_t net = netTicks(s);
+        fprintf(out, "  %6.2f %6.2f %14llu %8.2f  %s%02X %s\n", ticks ? 100.0 * net / ticks : 0.0,
+                100.0 * s.count / total, (unsigned long long) s.count, net * nsPerTick / s.count, prefix, order[i],
+                names[order[i]]);
+    }
+}
+
+void Profiler::report(FILE* out, const char* const* names, const char* const* namesCB) const {
+    uint64_t total = instructions();
+    if (total == 0) return;
+    double elapsedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - startTime).count();
+    uint64_t elapsedTicks = now() - startTicks;
+    double nsPerTick = PROFILER_TSC && elapsedTicks ? elapsedNs / elapsedTicks : 1.0;
+
+    fprintf(out, "\nprofile: %llu instructions, %llu CB prefixed\n", (unsigned long long) total,
+            (unsigned long long) instructions(true));
+    // %exec of CB opcodes is relative to all instructions as well
+    reportOpcodes(out, "opcodes by time", opcodes, names, "", total, nsPerTick);
+    reportOpcodes(out, "CB opcodes by time", cbOpcodes, namesCB, "CB ", total, nsPerTick);
+
+    std::vector<int> order(0x10000);
+    std::iota(order.begin(), order.end(), 0);
+    auto top = order.begin() + std::min<size_t>(TOP_ADDRESSES, order.size());
+    std::partial_sort(order.begin(), top, order.end(), [this](int a, int b) { return pcHits[a] > pcHits[b]; });
+    fprintf(out, "\nhottest addresses\n  %6s %14s  %s\n", "%exec", "executions", "pc");
+    for (auto it = order.begin(); it != top && pcHits[*it]; ++it) {
+        fprintf(out, "  %6.2f %14llu  0x%04X\n", 100.0 * pcHits[*it] / total, (unsigned long long) pcHits[*it], *it);
+    }
+}
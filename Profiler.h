@@ -0,0 +1,76 @@
+//
+// Per-opcode and per-address execution profile of the single-step cores (see CPU::stepCPU, GB_PROFILE).
+//
+
+#ifndef NESEMULATOR_PROFILER_H
+#define NESEMULATOR_PROFILER_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PROFILER_TSC 1
+#include <x86intrin.h>
+#else
+#define PROFILER_TSC 0
+#endif
+
+/**
+ * Counts executions and host time per opcode (unprefixed and CB tables separately) and executions
+ * per PC. Time is taken with the TSC where there is one (a few cycles per read, no system call) and
+ * converted to nanoseconds at report time against the wall clock over the profile's lifetime.
+ * The timestamps bracket the handler only, so the opcode fetch and the profiling itself aren't in it
+ * (bar the cost of reading the clock, which is measured once and subtracted).
+ *
+ * Only exists in GB_PROFILE builds; without it the CPU has no profiler and no extra code at all.
+ */
+class Profiler {
+public:
+    Profiler();
+
+    // TSC ticks, or nanoseconds where there is no TSC
+    static uint64_t now() {
+#if PROFILER_TSC
+        return __rdtsc();
+#else
+        return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    void record(uint16_t pc, bool prefixed, uint8_t opcode, uint64_t ticks) {
+        STATS& stats = prefixed ? cbOpcodes[opcode] : opcodes[opcode];
+        stats.count++;
+        stats.ticks += ticks;
+        pcHits[pc]++;
+    }
+
+    // instructions recorded (prefixedOnly: just the CB ones; those aren't under 0xCB in the unprefixed table)
+    uint64_t instructions(bool prefixedOnly = false) const;
+    // Sorted report: opcodes by time, CB opcodes by time, then the hottest addresses.
+    // names / namesCB: mnemonics by opcode (CPU::OpcodeTable)
+    void report(FILE* out, const char* const* names, const char* const* namesCB) const;
+    void reset();
+
+private:
+    struct STATS {
+        uint64_t count;
+        uint64_t ticks;
+    };
+
+    void reportOpcodes(FILE* out, const char* title, const std::array<STATS, 256>& table, const char* const* names,
+                       const char* prefix, uint64_t total, double nsPerTick) const;
+
+    std::array<STATS, 256> opcodes{};
+    std::array<STATS, 256> cbOpcodes{};
+    std::vector<uint64_t> pcHits;
+    uint64_t readCost = 0;  // ticks between two back to back now() calls, taken off every sample in the report
+    uint64_t startTicks = 0;
+    std::chrono::steady_clock::time_point startTime;
+};
+
+
+#endif //NESEMULATOR_PROFILER_H
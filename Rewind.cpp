@@ -0,0 +1,161 @@
+//
+// Rewind history (see Rewind.h).
+//
+
+#include "Rewind.h"
+#include "Bus.h"
+#include <cstring>
+
+namespace {
+
+void putVarint(std::vector<uint8_t>& out, size_t value) {
+    while (value >= 0x80u) {
+        out.push_back((uint8_t) (value | 0x80u));
+        value >>= 7u;
+    }
+    out.push_back((uint8_t) value);
+}
+
+bool getVarint(const uint8_t*& p, const uint8_t* end, size_t& value) {
+    value = 0;
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        value |= (size_t) (b & 0x7Fu) << shift;
+        if (!(b & 0x80u)) return true;
+    }
+    return false;
+}
+
+void xorInto(uint8_t* dst, const uint8_t* src, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t a, b;
+        std::memcpy(&a, dst + i, 8);
+        std::memcpy(&b, src + i, 8);
+        a ^= b;
+        std::memcpy(dst + i, &a, 8);
+    }
+    for (; i < size; i++) dst[i] ^= src[i];
+}
+
+// a zero run shorter than this costs more as a token than as literal bytes
+const size_t MIN_ZERO_RUN = 4;
+
+} // namespace
+
+Rewind::Rewind(size_t budget) : arena(budget) {}
+
+void Rewind::clear() {
+    deltas.clear();
+    usedBytes = 0;
+    current.clear();
+}
+
+void Rewind::push(Bus& bus) {
+    bus.saveState(scratch);
+    if (current.size() != scratch.size()) {
+        // first state (or a different machine): nothing to take a delta against
+        clear();
+        current.swap(scratch);
+        return;
+    }
+    // current ^= newest gives the delta back to current; the newest becomes current
+    xorInto(current.data(), scratch.data(), current.size());
+    encode(current, encoded);
+    current.swap(scratch);
+    if (!store(encoded)) {
+        // a single delta larger than the whole budget: only the newest state is left
+        deltas.clear();
+        usedBytes = 0;
+    }
+}
+
+bool Rewind::stepBack(Bus& bus) {
+    if (deltas.empty()) return false;
+    const DELTA& delta = deltas.back();
+    scratch = current;
+    if (!apply(arena.data() + delta.offset, delta.length, scratch) || !bus.loadState(scratch.data(), scratch.size())) {
+        return false;
+    }
+    current.swap(scratch);
+    usedBytes -= delta.length;
+    deltas.pop_back();
+    return true;
+}
+
+bool Rewind::restore(Bus& bus) const {
+    return !current.empty() && bus.loadState(current.data(), current.size());
+}
+
+bool Rewind::store(const std::vector<uint8_t>& data) {
+    size_t length = data.size();
+    if (length > arena.size()) return false;
+    size_t pos = deltas.empty() ? 0 : deltas.back().offset + deltas.back().length;
+    if (pos + length > arena.size()) {
+        // wrap: whatever sits between here and the end of the arena is older than what's at its start
+        while (!deltas.empty() && deltas.front().offset >= pos) {
+            usedBytes -= deltas.front().length;
+            deltas.pop_front();
+        }
+        pos = 0;
+    }
+    // the oldest deltas are the ones right after the write position
+    while (!deltas.empty() && deltas.front().offset < pos + length &&
+           deltas.front().offset + deltas.front().length > pos) {
+        usedBytes -= deltas.front().length;
+        deltas.pop_front();
+    }
+    std::memcpy(arena.data() + pos, data.data(), length);
+    deltas.push_back(DELTA{pos, length});
+    usedBytes += length;
+    return true;
+}
+
+void Rewind::encode(const std::vector<uint8_t>& delta, std::vector<uint8_t>& out) {
+    out.clear();
+    const uint8_t* data = delta.data();
+    size_t size = delta.size(), i = 0;
+    while (i < size) {
+        size_t zeros = i;
+        // skip zeros a word at a time, they are most of the delta
+        while (zeros + 8 <= size) {
+            uint64_t word;
+            std::memcpy(&word, data + zeros, 8);
+            if (word) break;
+            zeros += 8;
+        }
+        while (zeros < size && !data[zeros]) zeros++;
+        // literal bytes up to the next zero run worth a token
+        size_t end = zeros;
+        while (end < size) {
+            if (!data[end]) {
+                size_t run = end;
+                while (run < size && run - end < MIN_ZERO_RUN && !data[run]) run++;
+                if (run - end >= MIN_ZERO_RUN || run == size) break;
+                end = run;
+            } else {
+                end++;
+            }
+        }
+        putVarint(out, zeros - i);
+        putVarint(out, end - zeros);
+        out.insert(out.end(), data + zeros, data + end);
+        i = end;
+    }
+}
+
+bool Rewind::apply(const uint8_t* encoded, size_t length, std::vector<uint8_t>& state) {
+    const uint8_t* p = encoded;
+    const uint8_t* end = encoded + length;
+    size_t pos = 0;
+    while (p < end) {
+        size_t zeros, literal;
+        if (!getVarint(p, end, zeros) || !getVarint(p, end, literal)) return false;
+        pos += zeros;
+        if (literal > (size_t) (end - p) || pos + literal > state.size()) return false;
+        for (size_t k = 0; k < literal; k++) state[pos + k] ^= p[k];
+        p += literal;
+        pos += literal;
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+//
+// Rewind history: a fixed-size ring of delta compressed save states (see Bus::saveState).
+//
+
+#ifndef NESEMULATOR_REWIND_H
+#define NESEMULATOR_REWIND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+class Bus;
+
+/**
+ * Only the newest snapshot is kept whole. Every older one is stored as the XOR of it and its
+ * successor, so stepping back is "XOR the newest delta into the current snapshot and load it".
+ * Between two frames almost nothing changes, which makes the deltas mostly zero bytes; they are
+ * stored as runs: (zero run length, literal length, literal bytes) with varint lengths.
+ *
+ * Deltas go into one arena allocated up front, used as a ring: when a delta doesn't fit, the oldest
+ * ones are dropped, so the memory used never grows past the budget however long the run is.
+ */
+class Rewind {
+public:
+    // budget: bytes for the compressed history (the newest snapshot comes on top of that)
+    explicit Rewind(size_t budget = 64u * 1024u * 1024u);
+
+    // Records the machine's current state as the newest point in the history (call once per frame)
+    void push(Bus& bus);
+    // Loads the state before the newest one into `bus` and drops the newest. False if there is no older
+    // state (the history then still holds the one it has).
+    bool stepBack(Bus& bus);
+    // Loads the newest state again (e.g. to undo whatever ran since the last push)
+    bool restore(Bus& bus) const;
+    void clear();
+
+    // states that can be loaded: the newest plus one per delta
+    size_t size() const { return current.empty() ? 0 : deltas.size() + 1; }
+    // compressed bytes in the arena
+    size_t used() const { return usedBytes; }
+    size_t budget() const { return arena.size(); }
+
+private:
+    struct DELTA {
+        size_t offset;
+        size_t length;
+    };
+
+    // Appends an encoded delta to the ring, dropping the oldest ones until it fits
+    bool store(const std::vector<uint8_t>& encoded);
+    // XOR run encoding of `delta` into `out` / XORs an encoded delta back into `state`
+    static void encode(const std::vector<uint8_t>& delta, std::vector<uint8_t>& out);
+    static bool apply(const uint8_t* encoded, size_t length, std::vector<uint8_t>& state);
+
+    std::vector<uint8_t> arena;
+    std::deque<DELTA> deltas;     // oldest first
+    size_t usedBytes = 0;
+    std::vector<uint8_t> current; // newest snapshot
+    std::vector<uint8_t> scratch; // the snapshot being taken, then its delta
+    std::vector<uint8_t> encoded;
+};
+
+
+#endif //NESEMULATOR_REWIND_H
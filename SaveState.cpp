@@ -0,0 +1,249 @@
+//
+// Save states for the Bus (see Bus::saveState).
+//
+
+#include "Bus.h"
+#include <cstdio>
+#include <cstring>
+
+/**
+ * Layout: "GBSS", the format version (u32), then chunks of tag (4 chars), payload length (u32) and
+ * payload. Loaders skip chunks they don't know. The chunks:
+ *   MACH  the MACHINE_STATE fields, packed in visit() order: the CPU and Bus state and the state of every
+ *         component
+ *   MEM   the 64KB address space array (WRAM, VRAM, OAM, I/O registers, HRAM...)
+ *   LCD   the PPU frame buffer (lines of the current frame may be drawn already)
+ *   CRAM  cartridge RAM, if the cartridge has any
+ */
+
+namespace {
+
+const char MAGIC[4] = {'G', 'B', 'S', 'S'};
+const size_t HEADER_SIZE = 8;
+const size_t CHUNK_HEADER_SIZE = 8;
+
+struct MACHINE_STATE {
+    CPU::State cpu;
+    Timer::State timer;
+    Scheduler::State scheduler;
+    PPU::State ppu;
+    Cartridge::State cartridge;
+    uint64_t clock;
+    uint32_t cartridgeRamSize;
+    uint16_t romChecksum;
+    bool cartridgeLoaded;
+    bool bootRomEnabled;
+    uint8_t buttons;
+    uint8_t joypadLines;
+};
+
+struct CHUNK {
+    const char* tag;
+    const uint8_t* data;
+    uint32_t size;
+};
+
+// The MACH chunk goes field by field rather than as the struct, so it has no padding: its bytes only
+// change when the machine does, which keeps Rewind's XOR deltas small
+class Packer {
+public:
+    explicit Packer(uint8_t* dst) : p(dst) {}
+    template <typename T>
+    void operator()(const T& value) {
+        std::memcpy(p, &value, sizeof(value));
+        p += sizeof(value);
+    }
+
+private:
+    uint8_t* p;
+};
+
+class Unpacker {
+public:
+    explicit Unpacker(const uint8_t* src) : p(src) {}
+    template <typename T>
+    void operator()(T& value) {
+        std::memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+    }
+
+private:
+    const uint8_t* p;
+};
+
+struct Counter {
+    uint32_t size = 0;
+    template <typename T>
+    void operator()(const T& value) { size += sizeof(value); }
+};
+
+// every field of a MACHINE_STATE, in chunk order (CPU::REGS' unused 8-bit copies are left out)
+template <typename IO, typename STATE>
+void visit(IO& io, STATE& m) {
+    io(m.cpu.regs.af.AF);
+    io(m.cpu.regs.bc.BC);
+    io(m.cpu.regs.de.DE);
+    io(m.cpu.regs.hl.HL);
+    io(m.cpu.regs.pc);
+    io(m.cpu.regs.sp);
+    io(m.cpu.eiDelay);
+    io(m.cpu.halted);
+    io(m.cpu.unpaused);
+    io(m.cpu.ime);
+    io(m.timer.synced);
+    io(m.timer.divider);
+    io(m.timer.tac);
+    io(m.scheduler.when);
+    io(m.ppu.onTime);
+    io(m.ppu.pending);
+    io(m.ppu.frameIndex);
+    io(m.ppu.frameCount);
+    io(m.ppu.renderedLines);
+    io(m.ppu.windowLine);
+    io(m.cartridge.rtcSeconds);
+    io(m.cartridge.rtcSynced);
+    io(m.cartridge.bankLow);
+    io(m.cartridge.bankHigh);
+    io(m.cartridge.rtcLatched);
+    io(m.cartridge.rtcLatch);
+    io(m.cartridge.ramEnabled);
+    io(m.cartridge.mode1);
+    io(m.cartridge.rtcHalted);
+    io(m.cartridge.rtcCarry);
+    io(m.clock);
+    io(m.cartridgeRamSize);
+    io(m.romChecksum);
+    io(m.cartridgeLoaded);
+    io(m.bootRomEnabled);
+    io(m.buttons);
+    io(m.joypadLines);
+}
+
+uint32_t machineSize() {
+    static const uint32_t size = [] {
+        Counter counter;
+        MACHINE_STATE m{};
+        visit(counter, m);
+        return counter.size;
+    }();
+    return size;
+}
+
+uint8_t* putChunk(uint8_t* dst, const char* tag, const void* data, uint32_t size) {
+    std::memcpy(dst, tag, 4);
+    std::memcpy(dst + 4, &size, 4);
+    std::memcpy(dst + CHUNK_HEADER_SIZE, data, size);
+    return dst + CHUNK_HEADER_SIZE + size;
+}
+
+} // namespace
+
+void Bus::saveState(std::vector<uint8_t>& out) {
+    MACHINE_STATE m{};
+    m.cpu = cpu.state();
+    m.timer = timer.state();
+    m.scheduler = scheduler.state();
+    m.ppu = ppu.state();
+    m.cartridge = cartridge.state();
+    m.clock = clock;
+    m.cartridgeRamSize = (uint32_t) cartridge.ramSize();
+    m.romChecksum = cartridge.checksum();
+    m.cartridgeLoaded = cartridge.loaded();
+    m.bootRomEnabled = bootRomEnabled;
+    m.buttons = held;
+    m.joypadLines = joypadLines;
+    uint8_t machine[sizeof(MACHINE_STATE)];
+    Packer packer(machine);
+    visit(packer, m);
+
+    const CHUNK chunks[] = {
+            {"MACH", machine, machineSize()},
+            {"MEM ", RAM.data(), (uint32_t) RAM.size()},
+            {"LCD ", ppu.framebuffer(), PPU::WIDTH * PPU::HEIGHT},
+            {"CRAM", cartridge.ram(), (uint32_t) cartridge.ramSize()},
+    };
+    size_t total = HEADER_SIZE;
+    for (const CHUNK& c : chunks) total += CHUNK_HEADER_SIZE + c.size;
+    // NOTE: resize keeps the capacity, so saving into the same vector again doesn't allocate
+    out.resize(total);
+    uint8_t* dst = out.data();
+    std::memcpy(dst, MAGIC, 4);
+    std::memcpy(dst + 4, &STATE_VERSION, 4);
+    dst += HEADER_SIZE;
+    for (const CHUNK& c : chunks) dst = putChunk(dst, c.tag, c.data, c.size);
+}
+
+bool Bus::loadState(const uint8_t* data, size_t size) {
+    uint32_t version;
+    if (size < HEADER_SIZE || std::memcmp(data, MAGIC, 4) != 0) return false;
+    std::memcpy(&version, data + 4, 4);
+    if (version != STATE_VERSION) return false;
+
+    // find every chunk first, so a bad blob changes nothing
+    const uint8_t* machine = nullptr, *mem = nullptr, *lcd = nullptr, *cram = nullptr;
+    size_t pos = HEADER_SIZE;
+    while (pos + CHUNK_HEADER_SIZE <= size) {
+        const uint8_t* tag = data + pos;
+        uint32_t length;
+        std::memcpy(&length, data + pos + 4, 4);
+        pos += CHUNK_HEADER_SIZE;
+        if (length > size - pos) return false;
+        const uint8_t* payload = data + pos;
+        pos += length;
+        if (!std::memcmp(tag, "MACH", 4)) machine = length == machineSize() ? payload : nullptr;
+        else if (!std::memcmp(tag, "MEM ", 4)) mem = length == RAM.size() ? payload : nullptr;
+        else if (!std::memcmp(tag, "LCD ", 4)) lcd = length == PPU::WIDTH * PPU::HEIGHT ? payload : nullptr;
+        else if (!std::memcmp(tag, "CRAM", 4)) cram = length == cartridge.ramSize() ? payload : nullptr;
+    }
+    if (!machine || !mem || !lcd || (!cram && cartridge.ramSize())) return false;
+    MACHINE_STATE m{};
+    Unpacker unpacker(machine);
+    visit(unpacker, m);
+    if (m.cartridgeLoaded != cartridge.loaded() || m.romChecksum != cartridge.checksum() ||
+        m.cartridgeRamSize != cartridge.ramSize()) {
+        return false;
+    }
+
+    std::memcpy(RAM.data(), mem, RAM.size());
+    cpu.restore(m.cpu);
+    timer.restore(m.timer);
+    scheduler.restore(m.scheduler);
+    ppu.restore(m.ppu, lcd);
+    cartridge.restore(m.cartridge, cram);
+    clock = m.clock;
+    bootRomEnabled = m.bootRomEnabled && !bootRomData.empty();
+    held = m.buttons;
+    joypadLines = m.joypadLines;
+    mapPages();
+    // the decoded code may come from other banks (or other code written to RAM-backed ROM)
+    cpu.invalidateBlocks(0x0000, BlockCache::CACHED_END - 1);
+    updateInterrupts();
+    return true;
+}
+
+bool Bus::saveStateFile(const std::string& path) {
+    std::vector<uint8_t> state;
+    saveState(state);
+    // write next to it and rename, so an interrupted save never leaves a truncated state behind
+    std::string temp = path + ".tmp";
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file) return false;
+    bool written = fwrite(state.data(), 1, state.size(), file) == state.size();
+    written = fclose(file) == 0 && written;
+    if (!written || std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Bus::loadStateFile(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    std::vector<uint8_t> state;
+    uint8_t buffer[64 * 1024];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) state.insert(state.end(), buffer, buffer + n);
+    fclose(file);
+    return loadState(state.data(), state.size());
+}
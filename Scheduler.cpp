@@ -0,0 +1,84 @@
+//
+// Event queue keyed by absolute machine time (see Scheduler.h).
+//
+
+#include "Scheduler.h"
+
+void Scheduler::schedule(EVENT event, uint64_t when) {
+    int i = pos[event];
+    if (i < 0) {
+        i = size++;
+    } else if (when > heap[i].when) {
+        heap[i].when = when;
+        siftDown(i);
+        return;
+    }
+    place(i, ENTRY{when, event});
+    siftUp(i);
+}
+
+void Scheduler::cancel(EVENT event) {
+    if (pos[event] >= 0) removeAt(pos[event]);
+}
+
+bool Scheduler::popDue(uint64_t now, EVENT& event) {
+    if (size == 0 || heap[0].when > now) return false;
+    event = heap[0].event;
+    removeAt(0);
+    return true;
+}
+
+void Scheduler::clear() {
+    size = 0;
+    pos.fill(-1);
+}
+
+void Scheduler::siftUp(int i) {
+    ENTRY e = heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!before(e, heap[parent])) break;
+        place(i, heap[parent]);
+        i = parent;
+    }
+    place(i, e);
+}
+
+void Scheduler::siftDown(int i) {
+    ENTRY e = heap[i];
+    while (true) {
+        int child = 2 * i + 1;
+        if (child >= size) break;
+        if (child + 1 < size && before(heap[child + 1], heap[child])) child++;
+        if (!before(heap[child], e)) break;
+        place(i, heap[child]);
+        i = child;
+    }
+    place(i, e);
+}
+
+void Scheduler::removeAt(int i) {
+    EVENT gone = heap[i].event;
+    size--;
+    if (i != size) {
+        // move the last entry into the hole; it may have to go either way
+        EVENT moved = heap[size].event;
+        place(i, heap[size]);
+        siftDown(i);
+        if (pos[moved] == i) siftUp(i);
+    }
+    pos[gone] = -1;
+}
+
+Scheduler::State Scheduler::state() const {
+    State s{};
+    for (int e = 0; e < EVENT_COUNT; e++) s.when[e] = scheduled((EVENT) e) ? heap[pos[e]].when : NEVER;
+    return s;
+}
+
+void Scheduler::restore(const State& s) {
+    clear();
+    for (int e = 0; e < EVENT_COUNT; e++) {
+        if (s.when[e] != NEVER) schedule((EVENT) e, s.when[e]);
+    }
+}
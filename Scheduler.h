@@ -0,0 +1,68 @@
+//
+// Event queue keyed by absolute machine time (see Bus::runChunk).
+//
+
+#ifndef NESEMULATOR_SCHEDULER_H
+#define NESEMULATOR_SCHEDULER_H
+
+#include <array>
+#include <cstdint>
+
+/**
+ * Binary min-heap of pending events. Every event type is pending at most once, so rescheduling
+ * one is a sift in place instead of a push. Timestamps are absolute clock (T-)cycles.
+ * Events due at the same time come out in EVENT order, which keeps runs deterministic.
+ */
+class Scheduler {
+public:
+    enum EVENT : uint8_t {
+        EVENT_TIMA = 0,   // TIMA overflows: reload from TMA and request the timer interrupt
+        EVENT_PPU,        // the PPU may raise VBLANK/LCD STAT (see PPU::nextEvent)
+        EVENT_SERIAL,     // a serial transfer started through SC (0xFF02) completes
+        EVENT_EI,         // the instruction after EI has run: IME turns on
+        EVENT_INPUT,      // an input movie changes the buttons held (see MovieSession)
+        EVENT_COUNT
+    };
+    static const uint64_t NEVER = UINT64_MAX;
+
+    Scheduler() { pos.fill(-1); }
+
+    // (Re)schedule `event` at absolute time `when`
+    void schedule(EVENT event, uint64_t when);
+    void cancel(EVENT event);
+    bool scheduled(EVENT event) const { return pos[event] >= 0; }
+    uint64_t nextTime() const { return size ? heap[0].when : NEVER; }
+    // Removes the earliest event if it is due at `now`
+    bool popDue(uint64_t now, EVENT& event);
+    void clear();
+
+    // Save state view: when each event is due, NEVER if it isn't pending
+    struct State {
+        uint64_t when[EVENT_COUNT];
+    };
+    State state() const;
+    void restore(const State& s);
+
+private:
+    struct ENTRY {
+        uint64_t when;
+        EVENT event;
+    };
+    static bool before(const ENTRY& a, const ENTRY& b) {
+        return a.when < b.when || (a.when == b.when && a.event < b.event);
+    }
+    void place(int i, const ENTRY& e) {
+        heap[i] = e;
+        pos[e.event] = i;
+    }
+    void siftUp(int i);
+    void siftDown(int i);
+    void removeAt(int i);
+
+    std::array<ENTRY, EVENT_COUNT> heap{};
+    std::array<int, EVENT_COUNT> pos{};
+    int size = 0;
+};
+
+
+#endif //NESEMULATOR_SCHEDULER_H
@@ -0,0 +1,83 @@
+//
+// DIV/TIMA timer (see Timer.h).
+//
+
+#include "Timer.h"
+
+// Register offsets in the I/O area
+#define DIV_REG 0x04u
+#define TIMA_REG 0x05u
+#define TMA_REG 0x06u
+#define TAC_REG 0x07u
+
+void Timer::reset(uint64_t now) {
+    synced = now;
+    divider = 0;
+    tac = io[TAC_REG];
+    io[DIV_REG] = 0;
+}
+
+unsigned Timer::shift() const {
+    static const unsigned shifts[4] = {10, 4, 6, 8};
+    return shifts[tac & 0x03u];
+}
+
+bool Timer::catchUp(uint64_t now) {
+    if (now <= synced) return false;
+    uint64_t elapsed = now - synced;
+    bool overflow = false;
+    if (enabled()) {
+        // TIMA increments once for every multiple of its period the counter passes
+        unsigned s = shift();
+        overflow = tick(((divider + elapsed) >> s) - (divider >> s));
+    }
+    divider = (uint16_t) (divider + elapsed);
+    io[DIV_REG] = (uint8_t) (divider >> 8u);
+    synced = now;
+    return overflow;
+}
+
+bool Timer::tick(uint64_t ticks) {
+    unsigned tima = io[TIMA_REG];
+    if (tima + ticks < 0x100u) {
+        io[TIMA_REG] = (uint8_t) (tima + ticks);
+        return false;
+    }
+    // first overflow, after that TIMA cycles through [TMA, 0xFF]
+    ticks -= 0x100u - tima;
+    unsigned span = 0x100u - io[TMA_REG];
+    io[TIMA_REG] = (uint8_t) (io[TMA_REG] + ticks % span);
+    return true;
+}
+
+bool Timer::write(uint16_t addr, uint8_t data) {
+    bool before = input();
+    switch (addr & 0xFFu) {
+        case DIV_REG:
+            // any write resets the whole counter
+            divider = 0;
+            io[DIV_REG] = 0;
+            break;
+        case TIMA_REG:
+            io[TIMA_REG] = data;
+            return false;
+        case TMA_REG:
+            io[TMA_REG] = data;
+            return false;
+        case TAC_REG:
+            tac = data;
+            io[TAC_REG] = data;
+            break;
+        default:
+            return false;
+    }
+    // TIMA counts falling edges of its input, so dropping it counts as an increment
+    return before && !input() && tick(1);
+}
+
+uint64_t Timer::nextOverflow() const {
+    if (!enabled()) return UINT64_MAX;
+    uint64_t period = 1ull << shift();
+    uint64_t firstTick = period - (divider & (period - 1));
+    return synced + firstTick + (0xFFu - io[TIMA_REG]) * period;
+}
@@ -0,0 +1,65 @@
+//
+// DIV/TIMA timer, caught up in closed form (see Bus::syncTimer).
+//
+
+#ifndef NESEMULATOR_TIMER_H
+#define NESEMULATOR_TIMER_H
+
+#include <cstdint>
+
+/**
+ * The timer subsystem is the DIV REG (0xFF04) plus three timer REGS (TIMA, TMA, TAC).
+ * DIV is the upper 8 bits of an internal 16-bit counter that increases every clock, so it
+ * increases every 256 oscillator clocks.
+ * TAC (0xFF07) enables/disables the timer (bit 2) and selects the counter bit TIMA follows (bits 1-0):
+ *   00: 4096Hz (every 1024 clocks), 01: 262144Hz (16), 10: 65536Hz (64), 11: 16384Hz (256)
+ * TIMA (0xFF05) increases at that rate until it overflows. Then the value in TMA (0xFF06) is loaded
+ * into TIMA and a TIMER interrupt is requested (by the Bus, see Bus::requestInterrupt).
+ *
+ * Nothing runs per clock: the counter is only advanced when the Bus catches the timer up to a point in
+ * time (a register access or a scheduled TIMA overflow). The register values live in the Bus I/O area.
+ */
+class Timer {
+public:
+    // io points at the I/O registers (0xFF00)
+    explicit Timer(uint8_t* io) : io(io) {}
+
+    // Power on state at time `now`
+    void reset(uint64_t now);
+    // Advances the counter from the last catch-up to `now` (clock cycles), updating DIV and TIMA.
+    // Returns true if TIMA overflowed on the way.
+    bool catchUp(uint64_t now);
+    // Register write at the time of the last catchUp. Returns true if it made TIMA overflow.
+    bool write(uint16_t addr, uint8_t data);
+    // Clock cycle time of the next TIMA overflow, UINT64_MAX while the timer is stopped
+    uint64_t nextOverflow() const;
+
+    // Save state view (the registers themselves are in the I/O area)
+    struct State {
+        uint64_t synced;
+        uint16_t divider;
+        uint8_t tac;
+    };
+    State state() const { return State{synced, divider, tac}; }
+    void restore(const State& s) {
+        synced = s.synced;
+        divider = s.divider;
+        tac = s.tac;
+    }
+
+private:
+    bool enabled() const { return (tac & 0x04u) != 0; }
+    // log2 of the clocks per TIMA increment for the cached TAC
+    unsigned shift() const;
+    // the counter bit TIMA counts the falling edges of (ANDed with the enable bit)
+    bool input() const { return enabled() && ((divider >> (shift() - 1)) & 1u); }
+    bool tick(uint64_t ticks);
+
+    uint8_t* io;
+    uint64_t synced = 0;   // time of the last catch-up
+    uint16_t divider = 0;  // internal counter, DIV is its high byte
+    uint8_t tac = 0;       // TAC as last written
+};
+
+
+#endif //NESEMULATOR_TIMER_H
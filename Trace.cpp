@@ -0,0 +1,291 @@
+//
+// Binary execution traces (see Trace.h).
+//
+
+#include "Trace.h"
+#include "Bus.h"
+#include <cstring>
+
+const char TraceCodec::MAGIC[4] = {'G', 'B', 'T', 'R'};
+
+namespace {
+
+uint64_t zigzag(int value) { return value < 0 ? ((uint64_t) -(int64_t) value << 1u) - 1 : (uint64_t) value << 1u; }
+int unzigzag(uint64_t value) { return (value & 1u) ? -(int) (value >> 1u) - 1 : (int) (value >> 1u); }
+
+// pc and sp wrap around like the CPU's do
+int wrapDelta(uint16_t to, uint16_t from) { return (int16_t) (uint16_t) (to - from); }
+
+} // namespace
+
+void TraceCodec::putVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80u) {
+        out.push_back((uint8_t) (value | 0x80u));
+        value >>= 7u;
+    }
+    out.push_back((uint8_t) value);
+}
+
+bool TraceCodec::getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        value |= (uint64_t) (b & 0x7Fu) << shift;
+        if (!(b & 0x80u)) return true;
+    }
+    return false;
+}
+
+void TraceCodec::reset() {
+    std::memset(table.data(), 0, table.size() * sizeof(SEEN));
+    std::memset(&previous, 0, sizeof previous);
+}
+
+void TraceCodec::encode(const TRACE_RECORD& record, std::vector<uint8_t>& out) {
+    size_t tagAt = out.size();
+    out.push_back(0);
+    uint8_t tag = 0;
+
+    SEEN& last = table[previous.pc];
+    if (record.pc != last.next) {
+        tag |= TAG_PC;
+        putVarint(out, zigzag(wrapDelta(record.pc, last.next)));
+    }
+    last.next = record.pc;
+    if (record.sp != previous.sp) {
+        tag |= TAG_SP;
+        putVarint(out, zigzag(wrapDelta(record.sp, previous.sp)));
+    }
+    SEEN& here = table[record.pc];
+    if (std::memcmp(record.mem, here.mem, sizeof here.mem) != 0) {
+        tag |= TAG_MEM;
+        out.insert(out.end(), record.mem, record.mem + sizeof record.mem);
+        std::memcpy(here.mem, record.mem, sizeof here.mem);
+    }
+    if (record.cycles != here.cycles) {
+        tag |= TAG_CYCLES;
+        putVarint(out, record.cycles);
+        here.cycles = record.cycles;
+    }
+    uint8_t mask = 0;
+    for (int i = 0; i < TRACE_RECORD::REG_COUNT; i++) {
+        if (record.regs[i] != previous.regs[i]) mask |= (uint8_t) (1u << i);
+    }
+    if (mask) {
+        tag |= TAG_REGS;
+        out.push_back(mask);
+        for (int i = 0; i < TRACE_RECORD::REG_COUNT; i++) {
+            if (mask & (1u << i)) out.push_back(record.regs[i]);
+        }
+    }
+    out[tagAt] = tag;
+    previous = record;
+}
+
+bool TraceCodec::decode(const uint8_t*& p, const uint8_t* end, TRACE_RECORD& record) {
+    if (p >= end) return false;
+    uint8_t tag = *p++;
+    uint64_t value;
+    record = previous;
+
+    SEEN& last = table[previous.pc];
+    record.pc = last.next;
+    if (tag & TAG_PC) {
+        if (!getVarint(p, end, value)) return false;
+        record.pc = (uint16_t) (record.pc + unzigzag(value));
+    }
+    last.next = record.pc;
+    if (tag & TAG_SP) {
+        if (!getVarint(p, end, value)) return false;
+        record.sp = (uint16_t) (record.sp + unzigzag(value));
+    }
+    SEEN& here = table[record.pc];
+    if (tag & TAG_MEM) {
+        if (end - p < (ptrdiff_t) sizeof here.mem) return false;
+        std::memcpy(here.mem, p, sizeof here.mem);
+        p += sizeof here.mem;
+    }
+    std::memcpy(record.mem, here.mem, sizeof here.mem);
+    if (tag & TAG_CYCLES) {
+        if (!getVarint(p, end, value)) return false;
+        here.cycles = (uint8_t) value;
+    }
+    record.cycles = here.cycles;
+    if (tag & TAG_REGS) {
+        if (p >= end) return false;
+        uint8_t mask = *p++;
+        for (int i = 0; i < TRACE_RECORD::REG_COUNT; i++) {
+            if (!(mask & (1u << i))) continue;
+            if (p >= end) return false;
+            record.regs[i] = *p++;
+        }
+    }
+    previous = record;
+    return true;
+}
+
+TraceRecorder::~TraceRecorder() {
+    close();
+}
+
+bool TraceRecorder::open(const std::string& path) {
+    close();
+    file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    // the file is written a block at a time, stdio's own buffering would only add a copy
+    setvbuf(file, nullptr, _IONBF, 0);
+    uint8_t header[5];
+    std::memcpy(header, TraceCodec::MAGIC, 4);
+    header[4] = TraceCodec::VERSION;
+    fwrite(header, 1, sizeof header, file);
+
+    filling.resize(BLOCK_RECORDS);
+    full.resize(BLOCK_RECORDS);
+    fill = 0;
+    recorded = 0;
+    hasFull = false;
+    stopping = false;
+    written = sizeof header;
+    thread = std::thread(&TraceRecorder::writer, this);
+    return true;
+}
+
+void TraceRecorder::close() {
+    if (!file) return;
+    if (fill) hand();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    thread.join();
+    fclose(file);
+    file = nullptr;
+}
+
+uint64_t TraceRecorder::bytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return written;
+}
+
+void TraceRecorder::capture(Bus& bus, TRACE_RECORD& record) {
+    CPU& cpu = bus.cpu;
+    cpu.flushFlags();
+    const CPU::REGS& r = cpu.regs;
+    record.pc = r.pc;
+    record.sp = r.sp;
+    record.regs[TRACE_RECORD::A] = r.af.A;
+    record.regs[TRACE_RECORD::F] = r.af.F;
+    record.regs[TRACE_RECORD::B] = r.bc.B;
+    record.regs[TRACE_RECORD::C] = r.bc.C;
+    record.regs[TRACE_RECORD::D] = r.de.D;
+    record.regs[TRACE_RECORD::E] = r.de.E;
+    record.regs[TRACE_RECORD::H] = r.hl.H;
+    record.regs[TRACE_RECORD::L] = r.hl.L;
+    for (int i = 0; i < 4; i++) record.mem[i] = bus.READ((uint16_t) (r.pc + i));
+}
+
+void TraceRecorder::hand() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return !hasFull; });
+    filling.swap(full);
+    fullCount = fill;
+    hasFull = true;
+    recorded += fill;
+    fill = 0;
+    lock.unlock();
+    cv.notify_all();
+}
+
+void TraceRecorder::writer() {
+    TraceCodec codec;
+    std::vector<uint8_t> encoded;
+    std::vector<uint8_t> header;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        cv.wait(lock, [this] { return hasFull || stopping; });
+        if (!hasFull) return;
+        // the emulation thread doesn't touch `full` until hasFull is cleared
+        lock.unlock();
+        codec.reset();
+        encoded.clear();
+        for (size_t i = 0; i < fullCount; i++) codec.encode(full[i], encoded);
+        header.clear();
+        TraceCodec::putVarint(header, fullCount);
+        TraceCodec::putVarint(header, encoded.size());
+        fwrite(header.data(), 1, header.size(), file);
+        fwrite(encoded.data(), 1, encoded.size(), file);
+        lock.lock();
+        written += header.size() + encoded.size();
+        hasFull = false;
+        cv.notify_all();
+    }
+}
+
+TraceReader::~TraceReader() {
+    if (file) fclose(file);
+}
+
+bool TraceReader::open(const std::string& path) {
+    if (file) fclose(file);
+    file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    uint8_t header[5];
+    if (fread(header, 1, sizeof header, file) != sizeof header ||
+        std::memcmp(header, TraceCodec::MAGIC, 4) != 0 || header[4] != TraceCodec::VERSION) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    left = 0;
+    count = 0;
+    corrupt = false;
+    return true;
+}
+
+bool TraceReader::readBlock() {
+    // the block header is two varints, read a byte at a time
+    uint64_t header[2];
+    for (uint64_t& value : header) {
+        value = 0;
+        int c = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            c = fgetc(file);
+            if (c == EOF) {
+                // the end of the file between two blocks is the regular end of the trace
+                corrupt = &value != header || shift != 0;
+                return false;
+            }
+            value |= (uint64_t) (c & 0x7F) << shift;
+            if (!(c & 0x80)) break;
+        }
+        if (c & 0x80) {
+            corrupt = true;
+            return false;
+        }
+    }
+    block.resize(header[1]);
+    if (fread(block.data(), 1, block.size(), file) != block.size()) {
+        corrupt = true;
+        return false;
+    }
+    codec.reset();
+    p = block.data();
+    end = p + block.size();
+    left = header[0];
+    return true;
+}
+
+bool TraceReader::next(TRACE_RECORD& record) {
+    if (!file || corrupt) return false;
+    while (left == 0) {
+        if (!readBlock()) return false;
+    }
+    if (!codec.decode(p, end, record)) {
+        corrupt = true;
+        return false;
+    }
+    left--;
+    count++;
+    return true;
+}
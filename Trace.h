@@ -0,0 +1,168 @@
+//
+// Binary execution traces: a compact, delta encoded record of every instruction (see Bus::run, tools/gbtrace.cpp).
+//
+
+#ifndef NESEMULATOR_TRACE_H
+#define NESEMULATOR_TRACE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Bus;
+
+/**
+ * One instruction: the machine state before it ran, the way gameboy-doctor logs it (registers, SP,
+ * PC and the 4 bytes at PC), and the M-cycles it took (including an interrupt dispatched right after it).
+ * NOTE: a trace only lines up with a gameboy-doctor reference log when it was recorded with LY pinned
+ * to 0x90 like those were (Bus::doctorLY, NESEmulator --doctor-ly).
+ */
+struct TRACE_RECORD {
+    enum REG { A, F, B, C, D, E, H, L, REG_COUNT };
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t regs[REG_COUNT];
+    uint8_t mem[4];
+    uint8_t cycles;
+};
+
+/**
+ * The trace file format. A file is a header ("GBTR", version) followed by blocks of
+ * (varint record count, varint byte length, encoded records). Every block starts from a clean
+ * encoder state, so blocks decode on their own and a trace cut short loses its last block at worst.
+ *
+ * A record is a tag byte saying which fields the predictions got wrong, then just those fields:
+ *   PC:      predicted as whatever followed the previous PC the last time it ran (straight-line code
+ *            and loops predict themselves); otherwise a zigzag varint of the difference
+ *   SP:      zigzag varint delta from the previous record
+ *   PCMEM:   predicted as the bytes seen at this PC last time; otherwise all 4 bytes
+ *   cycles:  predicted as the cycles taken at this PC last time; otherwise a varint
+ *   A..L:    a mask byte of the registers that changed, then their new values
+ * Most instructions come out at 1-3 bytes.
+ */
+class TraceCodec {
+public:
+    static const char MAGIC[4];
+    static const uint8_t VERSION = 1;
+
+    TraceCodec() : table(0x10000) { reset(); }
+
+    void reset();
+    void encode(const TRACE_RECORD& record, std::vector<uint8_t>& out);
+    // False on a truncated or corrupt record
+    bool decode(const uint8_t*& p, const uint8_t* end, TRACE_RECORD& record);
+
+    static void putVarint(std::vector<uint8_t>& out, uint64_t value);
+    static bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value);
+
+private:
+    enum TAG : uint8_t {
+        TAG_PC = 0x01,
+        TAG_SP = 0x02,
+        TAG_MEM = 0x04,
+        TAG_CYCLES = 0x08,
+        TAG_REGS = 0x10,
+    };
+    // what was seen at a PC last time
+    struct SEEN {
+        uint16_t next;
+        uint8_t cycles;
+        uint8_t mem[4];
+    };
+
+    std::vector<SEEN> table;
+    TRACE_RECORD previous;
+};
+
+/**
+ * Records a trace to a file. The emulation thread only copies fixed-size records into the current
+ * buffer; when it is full the buffers are swapped and a background thread encodes and writes the full
+ * one while the next fills up (it only waits if the writer is a whole buffer behind).
+ */
+class TraceRecorder {
+public:
+    TraceRecorder() = default;
+    // Writes out what is buffered and closes the file
+    ~TraceRecorder();
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return file != nullptr; }
+
+    // The state before the instruction about to run on `bus`, then the M-cycles it took
+    void before(Bus& bus) { capture(bus, pending); }
+    void after(int cycles) {
+        pending.cycles = (uint8_t) (cycles > 0xFF ? 0xFF : cycles);
+        filling[fill++] = pending;
+        if (fill == BLOCK_RECORDS) hand();
+    }
+
+    // Fills in everything but the cycles for the instruction about to run on `bus`
+    static void capture(Bus& bus, TRACE_RECORD& record);
+
+    uint64_t records() const { return recorded + fill; }
+    // encoded bytes written so far (header included)
+    uint64_t bytes() const;
+
+private:
+    static const size_t BLOCK_RECORDS = 1u << 16u;
+
+    // Hands the filled buffer to the writer and continues in the other one
+    void hand();
+    void writer();
+
+    FILE* file = nullptr;
+    TRACE_RECORD pending{};
+    std::vector<TRACE_RECORD> filling;
+    size_t fill = 0;
+    uint64_t recorded = 0;
+
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<TRACE_RECORD> full; // handed to the writer
+    size_t fullCount = 0;
+    bool hasFull = false;
+    bool stopping = false;
+    uint64_t written = 0;
+};
+
+/**
+ * Reads a trace back record by record.
+ */
+class TraceReader {
+public:
+    TraceReader() = default;
+    ~TraceReader();
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    bool open(const std::string& path);
+    // False at the end of the trace or on a corrupt one (see error())
+    bool next(TRACE_RECORD& record);
+    // index of the record next() returned last
+    uint64_t index() const { return count - 1; }
+    bool error() const { return corrupt; }
+
+private:
+    bool readBlock();
+
+    FILE* file = nullptr;
+    TraceCodec codec;
+    std::vector<uint8_t> block;
+    const uint8_t* p = nullptr;
+    const uint8_t* end = nullptr;
+    uint64_t left = 0; // records left in the block
+    uint64_t count = 0;
+    bool corrupt = false;
+};
+
+
+#endif //NESEMULATOR_TRACE_H
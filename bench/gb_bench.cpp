@@ -0,0 +1,505 @@
+//
+// Microbenchmarks for the emulator core.
+// Usage: gb_bench [repetitions] [--json] [--rom=<path>]
+//   repetitions   timed runs per benchmark (default 5), after one untimed warm-up run
+//   --json        print the results as one JSON document instead of the text report
+//   --rom=<path>  ROM for the full-ROM frames/sec benchmark (default cpu_instrs.gb; skipped if missing)
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "Bus.h"
+#include "PixelKernels.h"
+#include "Rewind.h"
+
+using std::uint8_t;
+using std::uint16_t;
+
+namespace {
+
+const uint16_t PROGRAM_START = 0x0100;
+const uint64_t INSTRUCTIONS_PER_RUN = 4000000;
+
+/**
+ * Synthetic opcode streams. Each is a straight-line mix that loops back to its own start
+ * with an unconditional JP, so none of them depends on what the instructions compute.
+ */
+struct STREAM {
+    const char* name;
+    std::vector<uint8_t> code;
+};
+
+const std::vector<STREAM> STREAMS = {
+    // ALU, load and CB-prefixed instructions together
+    {"mixed", {
+        0x21, 0x00, 0xC0, // LD HL,0xC000
+        // loop:
+        0x3C,             // INC A
+        0x80,             // ADD A,B
+        0x4F,             // LD C,A
+        0xAA,             // XOR D
+        0x1D,             // DEC E
+        0x60,             // LD H,B
+        0x26, 0xC0,       // LD H,0xC0
+        0xCB, 0x37,       // SWAP A
+        0x91,             // SUB C
+        0xA3,             // AND E
+        0xB5,             // OR L
+        0xB8,             // CP B
+        0x07,             // RLCA
+        0x03,             // INC BC
+        0x1B,             // DEC DE
+        0x77,             // LD (HL),A
+        0x7E,             // LD A,(HL)
+        0x06, 0x12,       // LD B,0x12
+        0xCB, 0x11,       // RL C
+        0xC3, 0x03, 0x01, // JP loop
+    }},
+    // 8-bit and 16-bit arithmetic and logic on registers and immediates
+    {"alu", {
+        // loop:
+        0x80,             // ADD A,B
+        0x89,             // ADC A,C
+        0x92,             // SUB D
+        0x9B,             // SBC A,E
+        0xA4,             // AND H
+        0xAD,             // XOR L
+        0xB0,             // OR B
+        0xB9,             // CP C
+        0xC6, 0x11,       // ADD A,0x11
+        0xD6, 0x05,       // SUB 0x05
+        0xE6, 0xF7,       // AND 0xF7
+        0xEE, 0x5A,       // XOR 0x5A
+        0xFE, 0x42,       // CP 0x42
+        0x3C,             // INC A
+        0x05,             // DEC B
+        0x0C,             // INC C
+        0x09,             // ADD HL,BC
+        0x13,             // INC DE
+        0x2F,             // CPL
+        0x27,             // DAA
+        0x3F,             // CCF
+        0xC3, 0x00, 0x01, // JP loop
+    }},
+    // register moves, immediates, (HL) with increment/decrement, absolute and high page accesses, PUSH/POP
+    {"load", {
+        // loop:
+        0x21, 0x00, 0xC0, // LD HL,0xC000
+        0x47,             // LD B,A
+        0x48,             // LD C,B
+        0x51,             // LD D,C
+        0x5A,             // LD E,D
+        0x3E, 0x37,       // LD A,0x37
+        0x77,             // LD (HL),A
+        0x22,             // LDI (HL),A
+        0x32,             // LDD (HL),A
+        0x7E,             // LD A,(HL)
+        0x2A,             // LDI A,(HL)
+        0x46,             // LD B,(HL)
+        0x36, 0x99,       // LD (HL),0x99
+        0xEA, 0x10, 0xC1, // LD (0xC110),A
+        0xFA, 0x10, 0xC1, // LD A,(0xC110)
+        0xE0, 0x80,       // LDH (0x80),A
+        0xF0, 0x80,       // LDH A,(0x80)
+        0x12,             // LD (DE),A
+        0x0A,             // LD A,(BC)
+        0xC5,             // PUSH BC
+        0xD1,             // POP DE
+        0xC3, 0x00, 0x01, // JP loop
+    }},
+    // taken and not taken conditional branches on flags set right before them
+    {"branch", {
+        // loop:
+        0xAF,             // XOR A            Z set, C clear
+        0x28, 0x00,       // JR Z,+0          taken
+        0x20, 0x00,       // JR NZ,+0         not taken
+        0xCA, 0x08, 0x01, // JP Z,0x0108      taken
+        0x38, 0x00,       // JR C,+0          not taken
+        0x30, 0x00,       // JR NC,+0         taken
+        0x3C,             // INC A            Z clear
+        0x20, 0x00,       // JR NZ,+0         taken
+        0xCA, 0x00, 0x01, // JP Z,loop        not taken
+        0xC2, 0x15, 0x01, // JP NZ,0x0115     taken
+        0x18, 0x00,       // JR +0
+        0xC3, 0x00, 0x01, // JP loop
+    }},
+    // shifts, rotates and bit operations on registers and (HL)
+    {"cb", {
+        0x21, 0x00, 0xC0, // LD HL,0xC000
+        // loop:
+        0xCB, 0x37,       // SWAP A
+        0xCB, 0x10,       // RL B
+        0xCB, 0x19,       // RR C
+        0xCB, 0x22,       // SLA D
+        0xCB, 0x2B,       // SRA E
+        0xCB, 0x3C,       // SRL H
+        0x26, 0xC0,       // LD H,0xC0
+        0xCB, 0x47,       // BIT 0,A
+        0xCB, 0x7E,       // BIT 7,(HL)
+        0xCB, 0x88,       // RES 1,B
+        0xCB, 0xD1,       // SET 2,C
+        0xCB, 0x06,       // RLC (HL)
+        0xCB, 0xFE,       // SET 7,(HL)
+        0xCB, 0x0F,       // RRC A
+        0xC3, 0x03, 0x01, // JP loop
+    }},
+};
+
+struct CORE {
+    const char* name;
+    CPU::DISPATCH_MODE mode;
+};
+
+const std::vector<CORE> CORES = {
+    {"switch", CPU::DISPATCH_SWITCH},
+    {"table", CPU::DISPATCH_TABLE},
+#if GB_THREADED
+    {"threaded", CPU::DISPATCH_THREADED},
+#endif
+    {"block", CPU::DISPATCH_BLOCK},
+#if GB_JIT
+    {"jit", CPU::DISPATCH_JIT},
+#endif
+};
+
+// Median and spread of the timed runs of one benchmark, in units of work per second
+struct RATE {
+    double median;
+    double low;
+    double high;
+};
+
+// Runs fn() once to warm up (caches, branch predictors, lazily built tables, JIT code), then `reps`
+// times timed. fn returns the units of work it did.
+template<typename F>
+RATE measure(int reps, F fn) {
+    fn();
+    std::vector<double> rates;
+    for (int i = 0; i < reps; i++) {
+        auto start = std::chrono::steady_clock::now();
+        double work = fn();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        rates.push_back(work / elapsed.count());
+    }
+    std::sort(rates.begin(), rates.end());
+    return RATE{rates[rates.size() / 2], rates.front(), rates.back()};
+}
+
+/**
+ * Collects every result. The text report is printed as the results come in; --json prints all of
+ * them at the end (group, name, unit, median and the lowest/highest run, so a tracker can tell a
+ * regression from noise).
+ */
+class Report {
+public:
+    Report(bool json, int reps) : json(json), reps(reps) {}
+
+    void section(const std::string& title) {
+        if (!json) printf("%s (median of %d runs)\n", title.c_str(), reps);
+    }
+
+    // note: text report only (ratios and such)
+    void add(const std::string& group, const std::string& name, const char* unit, const RATE& rate,
+             const std::string& note = "") {
+        results.push_back(RESULT{group, name, unit, rate});
+        if (json) return;
+        double spread = rate.median > 0 ? 100.0 * (rate.high - rate.low) / rate.median : 0;
+        printf("  %-12s %14.0f %-22s +-%4.1f%%%s%s\n", name.c_str(), rate.median, unit, spread / 2,
+               note.empty() ? "" : "  ", note.c_str());
+    }
+
+    void skip(const std::string& group, const std::string& why) {
+        if (!json) printf("  (%s skipped: %s)\n", group.c_str(), why.c_str());
+    }
+
+    void finish() const {
+        if (!json) return;
+        printf("{\n  \"reps\": %d,\n  \"results\": [", reps);
+        for (size_t i = 0; i < results.size(); i++) {
+            const RESULT& r = results[i];
+            printf("%s\n    {\"group\": \"%s\", \"name\": \"%s\", \"unit\": \"%s\", \"median\": %.6g, \"min\": %.6g, "
+                   "\"max\": %.6g}", i ? "," : "", r.group.c_str(), r.name.c_str(), r.unit.c_str(), r.rate.median,
+                   r.rate.low, r.rate.high);
+        }
+        printf("\n  ]\n}\n");
+    }
+
+private:
+    struct RESULT {
+        std::string group;
+        std::string name;
+        std::string unit;
+        RATE rate;
+    };
+
+    bool json;
+    int reps;
+    std::vector<RESULT> results;
+};
+
+std::string ratio(double value, double base) {
+    char text[32];
+    snprintf(text, sizeof text, "(%.2fx)", value / base);
+    return text;
+}
+
+// A Bus with no cartridge (0x0000-0x7FFF is plain RAM) running `program` from PROGRAM_START
+std::unique_ptr<Bus> programBus(const std::vector<uint8_t>& program) {
+    // Bus holds the full 64KB address space inline, keep it off the stack
+    std::unique_ptr<Bus> bus(new Bus());
+    std::copy(program.begin(), program.end(), bus->RAM.begin() + PROGRAM_START);
+    // registers are only set up by init(): start from zero, so every run computes the same values
+    bus->cpu.regs = CPU::REGS{};
+    bus->cpu.regs.pc = PROGRAM_START;
+    bus->cpu.regs.sp = 0xFFFE;
+    return bus;
+}
+
+// INSTRUCTIONS_PER_RUN instructions through stepCPU (single-step cores) or execute (the others)
+double runStream(Bus& bus, CPU::DISPATCH_MODE mode) {
+    bus.cpu.dispatchMode = mode;
+    bus.cpu.regs.pc = PROGRAM_START;
+    bus.cpu.regs.sp = 0xFFFE;
+    if (mode == CPU::DISPATCH_SWITCH || mode == CPU::DISPATCH_TABLE) {
+        for (uint64_t i = 0; i < INSTRUCTIONS_PER_RUN; i++) bus.cpu.stepCPU();
+        return INSTRUCTIONS_PER_RUN;
+    }
+    uint64_t start = bus.cpu.instructions();
+    while (bus.cpu.instructions() - start < INSTRUCTIONS_PER_RUN) bus.cpu.execute(1 << 16);
+    return (double) (bus.cpu.instructions() - start);
+}
+
+const int BUS_ACCESSES = 8000000;
+// keeps the reads from being optimized away
+volatile uint8_t readSink;
+
+double runReads(Bus& bus, uint16_t base, uint16_t mask) {
+    uint8_t sum = 0;
+    for (int i = 0; i < BUS_ACCESSES; i++) sum += bus.READ((uint16_t) (base + (i & mask)));
+    readSink = sum;
+    return BUS_ACCESSES;
+}
+
+double runWrites(Bus& bus, uint16_t base, uint16_t mask) {
+    for (int i = 0; i < BUS_ACCESSES; i++) bus.WRITE((uint16_t) (base + (i & mask)), (uint8_t) i);
+    return BUS_ACCESSES;
+}
+
+/**
+ * Waits for TIMA overflows at one TAC frequency (TMA 0xF0, so every 16 increments) with IME off:
+ * HALT until the timer requests its interrupt, clear IF, read TIMA and DIV, again. `poll` replaces the
+ * HALT with a NOP, which turns it into a busy loop reading the timer registers.
+ */
+std::vector<uint8_t> timerProgram(uint8_t tac, bool poll) {
+    return {
+        0x3E, 0xF0,                  // LD A,0xF0
+        0xE0, 0x06,                  // LDH (TMA),A
+        0x3E, (uint8_t) (tac | 4u),  // LD A,enabled | tac
+        0xE0, 0x07,                  // LDH (TAC),A
+        0x3E, 0x04,                  // LD A,IRQ_TIMER
+        0xE0, 0xFF,                  // LDH (IE),A
+        0xF3,                        // DI
+        // loop:
+        (uint8_t) (poll ? 0x00 : 0x76), // HALT / NOP
+        0xAF,                        // XOR A
+        0xE0, 0x0F,                  // LDH (IF),A
+        0xF0, 0x05,                  // LDH A,(TIMA)
+        0xF0, 0x04,                  // LDH A,(DIV)
+        0x18, 0xF6,                  // JR loop
+    };
+}
+
+const uint64_t CLOCKS_PER_SECOND = 4194304;
+const uint64_t FRAME_CLOCKS = 70224;
+
+// Runs `clocks` of emulated time through the Bus (events, interrupts and all). Returns emulated seconds.
+double runEmulated(Bus& bus, uint64_t clocks) {
+    uint64_t end = bus.clock + clocks;
+    while (bus.clock < end && !bus.haltedForever()) {
+        bus.runChunk((int) std::min<uint64_t>((end - bus.clock + 3) / 4, 1 << 16));
+    }
+    return (double) clocks / CLOCKS_PER_SECOND;
+}
+
+const int FRAMES_PER_RUN = 120;
+
+// FRAMES_PER_RUN frames of the ROM from power on (skipping the boot ROM), on a fresh machine every run
+double runFrames(const std::string& rom, CPU::DISPATCH_MODE mode) {
+    std::unique_ptr<Bus> bus(new Bus());
+    bus->verbose = false;
+    bus->serialEcho = false;
+    bus->batterySave = false;
+    bus->cpu.dispatchMode = mode;
+    bus->init(rom, true);
+    runEmulated(*bus, FRAMES_PER_RUN * FRAME_CLOCKS);
+    return FRAMES_PER_RUN;
+}
+
+const int PIXEL_PASSES = 200;
+// tiles a scanline fetches: 20 visible plus one for the fine scroll
+const int LINE_TILES = PPU::WIDTH / 8 + 1;
+
+// Decodes the whole tile data area (384 tiles) PIXEL_PASSES times
+double runTileDecode(const PixelKernels& kernels, const std::vector<uint8_t>& tileData, std::vector<uint8_t>& out) {
+    int rows = (int) tileData.size() / 2;
+    for (int pass = 0; pass < PIXEL_PASSES; pass++) kernels.decodeRows(tileData.data(), rows, out.data());
+    return (double) PIXEL_PASSES * rows * 8;
+}
+
+// Decodes the tile rows each line fetched and maps them through BGP, PIXEL_PASSES frames
+double runScanlines(const PixelKernels& kernels, const std::vector<uint8_t>& lineRows, std::vector<uint8_t>& frame) {
+    uint8_t colors[LINE_TILES * 8];
+    for (int pass = 0; pass < PIXEL_PASSES; pass++) {
+        for (int ly = 0; ly < PPU::HEIGHT; ly++) {
+            kernels.decodeRows(lineRows.data() + ly * LINE_TILES * 2, LINE_TILES, colors);
+            kernels.applyPalette(colors + (ly & 7), PPU::WIDTH, 0xE4, frame.data() + ly * PPU::WIDTH);
+        }
+    }
+    return (double) PIXEL_PASSES * PPU::WIDTH * PPU::HEIGHT;
+}
+
+const int SNAPSHOTS_PER_RUN = 2000;
+
+double runSnapshots(Bus& bus, std::vector<uint8_t>& state) {
+    for (int i = 0; i < SNAPSHOTS_PER_RUN; i++) bus.saveState(state);
+    return SNAPSHOTS_PER_RUN;
+}
+
+double runRestores(Bus& bus, const std::vector<uint8_t>& state) {
+    for (int i = 0; i < SNAPSHOTS_PER_RUN; i++) {
+        if (!bus.loadState(state.data(), state.size())) return 0;
+    }
+    return SNAPSHOTS_PER_RUN;
+}
+
+// Pushes SNAPSHOTS_PER_RUN frames into the rewind history, each touching a few WRAM bytes like a game would
+double runRewind(Bus& bus, Rewind& rewind) {
+    for (int i = 0; i < SNAPSHOTS_PER_RUN; i++) {
+        for (int k = 0; k < 64; k++) bus.RAM[0xC000u + ((i * 131 + k * 17) & 0x1FFF)]++;
+        rewind.push(bus);
+    }
+    return SNAPSHOTS_PER_RUN;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int reps = 5;
+    bool json = false;
+    std::string rom = "cpu_instrs.gb";
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--json") json = true;
+        else if (arg.compare(0, 6, "--rom=") == 0) rom = arg.substr(6);
+        else reps = std::max(1, std::atoi(argv[i]));
+    }
+    Report report(json, reps);
+
+    // opcode streams on every core
+    for (const STREAM& stream : STREAMS) {
+        report.section(std::string("dispatch, ") + stream.name + " stream");
+        std::unique_ptr<Bus> bus = programBus(stream.code);
+        double base = 0;
+        for (const CORE& core : CORES) {
+            RATE rate = measure(reps, [&]() { return runStream(*bus, core.mode); });
+            if (base == 0) base = rate.median;
+            report.add(std::string("dispatch.") + stream.name, core.name, "instructions/sec", rate,
+                       core.mode == CPU::DISPATCH_SWITCH ? "" : ratio(rate.median, base));
+        }
+    }
+
+    {
+        report.section("bus accesses");
+        std::unique_ptr<Bus> bus = programBus({});
+        // direct pages: plain memory, one load or store through the page table
+        report.add("bus", "read rom", "reads/sec", measure(reps, [&]() { return runReads(*bus, 0x0000, 0x7FFF); }));
+        report.add("bus", "read wram", "reads/sec", measure(reps, [&]() { return runReads(*bus, 0xC000, 0x1FFF); }));
+        report.add("bus", "write wram", "writes/sec", measure(reps, [&]() { return runWrites(*bus, 0xC000, 0x1FFF); }));
+        // slow paths: the I/O page handlers, the timer catching up, the PPU catching up and marking tiles
+        report.add("bus", "read hram", "reads/sec", measure(reps, [&]() { return runReads(*bus, 0xFF80, 0x7F); }));
+        report.add("bus", "write hram", "writes/sec", measure(reps, [&]() { return runWrites(*bus, 0xFF80, 0x7F); }));
+        report.add("bus", "read div", "reads/sec", measure(reps, [&]() { return runReads(*bus, 0xFF04, 0x01); }));
+        report.add("bus", "write vram", "writes/sec", measure(reps, [&]() { return runWrites(*bus, 0x8000, 0x17FF); }));
+    }
+
+    // the timer at each TAC frequency: overflow events while halted, register catch-up while polling
+    report.section("timer, emulated seconds per second with the LCD off");
+    static const char* const TAC_NAMES[4] = {"4096Hz", "262144Hz", "65536Hz", "16384Hz"};
+    for (int poll = 0; poll < 2; poll++) {
+        for (uint8_t tac = 0; tac < 4; tac++) {
+            std::unique_ptr<Bus> bus = programBus(timerProgram(tac, poll != 0));
+            bus->cpu.dispatchMode = CPU::DISPATCH_TABLE;
+            RATE rate = measure(reps, [&]() { return runEmulated(*bus, CLOCKS_PER_SECOND); });
+            report.add(poll ? "timer.poll" : "timer.halt", std::string(poll ? "poll " : "halt ") + TAC_NAMES[tac],
+                       "x realtime", rate);
+        }
+    }
+
+    report.section("frames, " + std::to_string(FRAMES_PER_RUN) + " of " + rom + " from power on");
+    if (access(rom.c_str(), R_OK) != 0) {
+        report.skip("frames", rom + " not found");
+    } else {
+        double base = 0;
+        for (const CORE& core : CORES) {
+            RATE rate = measure(reps, [&]() { return runFrames(rom, core.mode); });
+            if (base == 0) base = rate.median;
+            report.add("frames", core.name, "frames/sec", rate,
+                       core.mode == CPU::DISPATCH_SWITCH ? "" : ratio(rate.median, base));
+        }
+    }
+
+    {
+        std::unique_ptr<Bus> bus = programBus(STREAMS[0].code);
+        std::vector<uint8_t> state;
+        bus->saveState(state);
+        report.section("save states, " + std::to_string(state.size()) + " bytes");
+        report.add("states", "save", "snapshots/sec", measure(reps, [&]() { return runSnapshots(*bus, state); }));
+        report.add("states", "load", "snapshots/sec", measure(reps, [&]() { return runRestores(*bus, state); }));
+
+        Rewind rewind;
+        RATE push = measure(reps, [&]() { return runRewind(*bus, rewind); });
+        report.add("states", "rewind", "snapshots/sec", push,
+                   "(" + std::to_string(rewind.size()) + " states in " + std::to_string(rewind.used()) +
+                   " bytes of history)");
+        report.add("states", "stepback", "snapshots/sec", measure(reps, [&]() {
+            int steps = 0;
+            while (steps < SNAPSHOTS_PER_RUN && rewind.stepBack(*bus)) steps++;
+            return (double) steps;
+        }));
+    }
+
+    // random but fixed tile data, so every kernel sees the same bytes
+    std::vector<uint8_t> tileData(384 * 16), lineRows(PPU::HEIGHT * LINE_TILES * 2);
+    unsigned seed = 1;
+    for (auto& b : tileData) b = (uint8_t) ((seed = seed * 1103515245u + 12345u) >> 16);
+    for (auto& b : lineRows) b = (uint8_t) ((seed = seed * 1103515245u + 12345u) >> 16);
+    std::vector<uint8_t> decoded(tileData.size() * 4), frame(PPU::WIDTH * PPU::HEIGHT);
+
+    report.section("pixels");
+    double scalarTiles = 0, scalarLines = 0;
+    for (int isa = PixelKernels::ISA_SCALAR; isa < PixelKernels::ISA_COUNT; isa++) {
+        const PixelKernels* kernels = PixelKernels::get((PixelKernels::ISA) isa);
+        // sets this build or CPU can't run are left out
+        if (!kernels) continue;
+        RATE tiles = measure(reps, [&]() { return runTileDecode(*kernels, tileData, decoded); });
+        RATE lines = measure(reps, [&]() { return runScanlines(*kernels, lineRows, frame); });
+        if (isa == PixelKernels::ISA_SCALAR) {
+            scalarTiles = tiles.median;
+            scalarLines = lines.median;
+        }
+        report.add("pixels.tiles", std::string(kernels->name) + " tiles", "pixels/sec", tiles,
+                   ratio(tiles.median, scalarTiles));
+        report.add("pixels.lines", std::string(kernels->name) + " lines", "pixels/sec", lines,
+                   ratio(lines.median, scalarLines));
+    }
+
+    report.finish();
+    return 0;
+}
@@ -1,28 +1,162 @@
 #include <iostream>
 #include <string>
 #include <cstdint>
+#include <csignal>
+#include <cstdlib>
 #include "CPU.h"
 #include "Bus.h"
+#include "DoctorLog.h"
+#include "Lockstep.h"
+#include "Trace.h"
+
+namespace {
+
+// --dispatch=/--reference= core names; cores this build lacks fall back to the table core
+void parseCore(const std::string& name, CPU::DISPATCH_MODE& mode) {
+    if (CPU::parseDispatch(name, mode)) return;
+    if (name == "threaded" || name == "jit") {
+        std::cerr << "Warning: built without " << (name == "jit" ? "GB_JIT" : "GB_THREADED_DISPATCH")
+                  << "; using the table core." << std::endl;
+        mode = CPU::DISPATCH_TABLE;
+    } else {
+        std::cerr << "Warning: unknown core '" << name << "', ignoring it." << std::endl;
+    }
+}
+
+Bus* runningBus = nullptr;
+TraceRecorder* openTrace = nullptr;
+DoctorLog* openLog = nullptr;
+
+// Ctrl-C ends Bus::run, so the profile is printed and the trace written out on the way out
+void stopRunning(int) {
+    if (runningBus) runningBus->cpu.unpaused = false;
+}
+
+// also covers the exits from within the core (unsupported opcodes)
+void finishRun() {
+    if (openLog) openLog->close();
+    if (openTrace && openTrace->isOpen()) {
+        openTrace->close();
+        std::cout << "Traced " << openTrace->records() << " instructions into " << openTrace->bytes() << " bytes ("
+                  << (double) openTrace->bytes() / (double) (openTrace->records() ? openTrace->records() : 1)
+                  << " bytes per instruction)." << std::endl;
+    }
+#if GB_PROFILE
+    if (runningBus) runningBus->cpu.printProfile(stdout);
+#endif
+    runningBus = nullptr;
+}
+
+} // namespace
 
 int main(int argc, char** argv) {
     setbuf(stdout, NULL);
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <rom_file> [--skip-boot]" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <rom_file> [--skip-boot] [--trace[=0|1|2]] [--trace-file=<path>] [--doctor-log=<path>|-] [--doctor-ly] [--dispatch=switch|table|threaded|block|jit] [--lockstep[=<cycles>]] [--reference=<core>] [--lockstep-step]" << std::endl;
         return 1;
     }
 
     std::string romPath = argv[1];
     bool skipBoot = false;
+    CPU::TRACE_LEVEL traceLevel = CPU::TRACE_NONE;
+    // binary trace of every instruction (see Trace.h, tools/gbtrace)
+    std::string traceFile;
+    // gameboy-doctor log ("-": stdout)
+    std::string doctorFile;
+    // LY reads 0x90 (Bus::doctorLY); the doctor log implies it, a trace to diff against doctor logs needs it
+    bool doctorLY = false;
+    CPU::DISPATCH_MODE dispatchMode = CPU::DISPATCH_TABLE;
+    // 0: normal run, otherwise the number of cycles to compare against the reference core
+    uint64_t lockstepCycles = 0;
+    CPU::DISPATCH_MODE referenceMode = CPU::DISPATCH_SWITCH;
+    bool lockstepEveryInstruction = false;
 
     for (int i = 2; i < argc; ++i) {
-        if (std::string(argv[i]) == "--skip-boot") {
+        std::string arg(argv[i]);
+        if (arg == "--skip-boot") {
             skipBoot = true;
+        } else if (arg == "--trace") {
+            traceLevel = CPU::TRACE_FULL;
+        } else if (arg.compare(0, 8, "--trace=") == 0) {
+            std::string level = arg.substr(8);
+            if (level == "0" || level == "1" || level == "2") {
+                traceLevel = (CPU::TRACE_LEVEL) (level[0] - '0');
+            } else {
+                std::cerr << "Warning: unknown trace level '" << level << "', ignoring it." << std::endl;
+            }
+        } else if (arg.compare(0, 13, "--trace-file=") == 0) {
+            traceFile = arg.substr(13);
+        } else if (arg.compare(0, 13, "--doctor-log=") == 0) {
+            doctorFile = arg.substr(13);
+        } else if (arg == "--doctor-ly") {
+            doctorLY = true;
+        } else if (arg.compare(0, 11, "--dispatch=") == 0) {
+            parseCore(arg.substr(11), dispatchMode);
+        } else if (arg.compare(0, 12, "--reference=") == 0) {
+            parseCore(arg.substr(12), referenceMode);
+        } else if (arg == "--lockstep-step") {
+            lockstepEveryInstruction = true;
+        } else if (arg == "--lockstep") {
+            lockstepCycles = 1000000000ull;
+        } else if (arg.compare(0, 11, "--lockstep=") == 0) {
+            lockstepCycles = std::stoull(arg.substr(11));
         }
     }
 
+#if !GB_TRACE
+    if (traceLevel != CPU::TRACE_NONE || !traceFile.empty() || !doctorFile.empty()) {
+        std::cerr << "Warning: tracing was compiled out (GB_TRACE=OFF); ignoring --trace, --trace-file and --doctor-log." << std::endl;
+    }
+#endif
+
+    if (lockstepCycles != 0) {
+        // differential run of the selected core against the reference core
+        Lockstep lockstep(romPath, skipBoot, referenceMode, dispatchMode, lockstepEveryInstruction);
+        return lockstep.run(lockstepCycles) ? 0 : 1;
+    }
+
     Bus bus;
+    bus.traceLevel = traceLevel;
+    bus.doctorLY = doctorLY;
+    bus.cpu.dispatchMode = dispatchMode;
+#if GB_PROFILE
+    if (dispatchMode != CPU::DISPATCH_SWITCH && dispatchMode != CPU::DISPATCH_TABLE) {
+        std::cerr << "Warning: the profile only sees the switch and table cores; using the table core." << std::endl;
+        bus.cpu.dispatchMode = CPU::DISPATCH_TABLE;
+    }
+#endif
+#if GB_TRACE
+    static TraceRecorder recorder;
+    if (!traceFile.empty()) {
+        if (recorder.open(traceFile)) {
+            bus.traceRecorder = &recorder;
+            openTrace = &recorder;
+        } else {
+            std::cerr << "Warning: can't write the trace to " << traceFile << "." << std::endl;
+        }
+    }
+    static DoctorLog doctorLog;
+    if (!doctorFile.empty()) {
+        if (doctorLog.open(doctorFile)) {
+            bus.doctorLog = &doctorLog;
+            bus.doctorLY = true;
+            openLog = &doctorLog;
+            if (doctorFile == "-") {
+                // nothing but the log on stdout
+                bus.serialEcho = false;
+                bus.verbose = false;
+            }
+        } else {
+            std::cerr << "Warning: can't write the log to " << doctorFile << "." << std::endl;
+        }
+    }
+#endif
+    runningBus = &bus;
+    std::atexit(finishRun);
+    std::signal(SIGINT, stopRunning);
     bus.init(romPath, skipBoot);
     bus.run();
+    finishRun();
 
     return 0;
 }
@@ -0,0 +1,94 @@
+"""
+Generates ../Opcodes.inc, the X-macro list both opcode tables are built from.
+
+The source of truth is the reference switch in CPU::stepSwitch (CPU.cpp): every
+`case 0xNN: return EXPR;` is turned into an entry of the form
+
+    OP(0xNN, length, cycles, "NAME", EXPR)      <- unprefixed table
+    CB_OP(0xNN, length, cycles, "NAME", EXPR)   <- 0xCB prefixed table
+
+Opcodes without a mapping become ILLEGAL() and 0xCB becomes PREFIX_CB().
+Cycles are the nominal M-cycle counts (branch not taken); the handlers themselves
+still return the real count.
+Re-run this whenever an opcode mapping in stepSwitch changes.
+"""
+import os
+import re
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SOURCE = os.path.join(HERE, "..", "CPU.cpp")
+OUTPUT = os.path.join(HERE, "..", "Opcodes.inc")
+
+# Nominal M-cycles for the unprefixed table (conditional ops: branch not taken)
+MAIN_CYCLES = [
+    1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,  # 0x00
+    1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,  # 0x10
+    2, 3, 2, 2, 1, 1, 2, 1, 2, 2, 2, 2, 1, 1, 2, 1,  # 0x20
+    2, 3, 2, 2, 3, 3, 3, 1, 2, 2, 2, 2, 1, 1, 2, 1,  # 0x30
+]
+for op in range(0x40, 0xC0):
+    MAIN_CYCLES.append(2 if (op & 0x07) == 0x06 or (0x70 <= op <= 0x77 and op != 0x76) else 1)
+MAIN_CYCLES += [
+    2, 3, 3, 4, 3, 4, 2, 4, 2, 4, 3, 1, 3, 6, 2, 4,  # 0xC0
+    2, 3, 3, 1, 3, 4, 2, 4, 2, 4, 3, 1, 3, 1, 2, 4,  # 0xD0
+    3, 3, 2, 1, 1, 4, 2, 4, 4, 1, 4, 1, 1, 1, 2, 4,  # 0xE0
+    3, 3, 2, 1, 1, 4, 2, 4, 3, 2, 4, 1, 1, 1, 2, 4,  # 0xF0
+]
+
+
+def cb_cycles(op):
+    if (op & 0x07) != 0x06:
+        return 2
+    # BIT b,(HL) only reads memory
+    return 3 if 0x40 <= op <= 0x7F else 4
+
+
+def operand_length(expr):
+    if "ReadNn()" in expr:
+        return 3
+    if "ReadN()" in expr or "ReadI()" in expr:
+        return 2
+    return 1
+
+
+def parse_switch():
+    src = open(SOURCE).read()
+    body = src[src.index("int CPU::stepSwitch()"):]
+    body = body[:body.index("\n}\n")]
+    main_part, cb_part = body.split("case PREFIX:", 1)
+    case = re.compile(r"case (0x[0-9A-Fa-f]{2}):\s*return ([^;]+);")
+    main = {int(op, 16): expr.strip() for op, expr in case.findall(main_part)}
+    cb = {int(op, 16): expr.strip() for op, expr in case.findall(cb_part)}
+    return main, cb
+
+
+def name_of(expr):
+    return expr[:expr.index("(")]
+
+
+def main():
+    main_ops, cb_ops = parse_switch()
+    lines = [
+        "// GENERATED by scripts/OPCODE_gen.py from CPU::stepSwitch -- do not edit by hand.",
+        "// OP(opcode, length, cycles, name, expression) / CB_OP(...) for the 0xCB table.",
+        "// cycles are nominal M-cycles (branch not taken); handlers return the real count.",
+        "#ifdef OP",
+    ]
+    for op in range(256):
+        if op == 0xCB:
+            expr = "PREFIX_CB()"
+        else:
+            expr = main_ops.get(op, "ILLEGAL()")
+        lines.append('OP(0x%02X, %d, %d, "%s", %s)' % (op, operand_length(expr), MAIN_CYCLES[op], name_of(expr), expr))
+    lines.append("#endif")
+    lines.append("#ifdef CB_OP")
+    for op in range(256):
+        expr = cb_ops.get(op, "ILLEGAL()")
+        lines.append('CB_OP(0x%02X, 2, %d, "%s", %s)' % (op, cb_cycles(op), name_of(expr), expr))
+    lines.append("#endif")
+    with open(OUTPUT, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,99 @@
+//
+// Work-stealing thread pool (see ThreadPool.h).
+//
+
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace {
+
+// Pool and queue of the worker running on this thread, so tasks can queue follow-up work locally
+thread_local const void* currentPool = nullptr;
+thread_local unsigned currentQueue = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < threads; i++) queues.emplace_back(new QUEUE);
+    for (unsigned i = 0; i < threads; i++) workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    unsigned index;
+    {
+        // counted before it is queued: a worker may take it the moment it's in
+        std::lock_guard<std::mutex> guard(stateLock);
+        queued++;
+        unfinished++;
+        index = currentPool == this ? currentQueue : nextQueue++ % size();
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues[index]->lock);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(stateLock);
+    idle.wait(lock, [this] { return unfinished == 0; });
+}
+
+bool ThreadPool::take(unsigned index, std::function<void()>& task) {
+    {
+        QUEUE& own = *queues[index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (unsigned k = 1; k < size(); k++) {
+        QUEUE& victim = *queues[(index + k) % size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::work(unsigned index) {
+    currentPool = this;
+    currentQueue = index;
+    std::function<void()> task;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(stateLock);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (queued == 0) return;
+        }
+        // queued counts a task between its submit and its push as well: then there is nothing to take yet
+        if (!take(index, task)) {
+            std::this_thread::yield();
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            queued--;
+        }
+        task();
+        task = nullptr;
+        std::lock_guard<std::mutex> guard(stateLock);
+        if (--unfinished == 0) idle.notify_all();
+    }
+}
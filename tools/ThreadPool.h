@@ -0,0 +1,63 @@
+//
+// Work-stealing thread pool for the batch tools (see gbrunner.cpp).
+//
+
+#ifndef NESEMULATOR_THREADPOOL_H
+#define NESEMULATOR_THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Every worker owns a task deque. A worker takes its newest task first (the back) and, once its own
+ * deque is empty, steals the oldest task (the front) of another worker's, so a worker stuck with a long
+ * ROM doesn't hold up the short ones queued behind it. Tasks submitted from outside the pool are dealt
+ * round robin, tasks submitted by a task go to the deque of the worker running it.
+ *
+ * Emulator runs take milliseconds to minutes, so a mutex per deque is plenty; there is no lock-free
+ * deque here. Tasks must not throw.
+ */
+class ThreadPool {
+public:
+    // threads: 0 = one per hardware thread
+    explicit ThreadPool(unsigned threads = 0);
+    // Finishes every submitted task, then joins the workers
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+    // Blocks until every task submitted so far has finished
+    void wait();
+    unsigned size() const { return (unsigned) workers.size(); }
+
+private:
+    struct QUEUE {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void work(unsigned index);
+    // Own queue's newest task, else the oldest one found in the others'
+    bool take(unsigned index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<QUEUE>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex stateLock;
+    std::condition_variable wake;   // a task was queued (or the pool is stopping)
+    std::condition_variable idle;   // the last task finished
+    size_t queued = 0;              // tasks waiting in some queue
+    size_t unfinished = 0;          // tasks submitted and not finished
+    unsigned nextQueue = 0;
+    bool stopping = false;
+};
+
+
+#endif //NESEMULATOR_THREADPOOL_H
@@ -0,0 +1,220 @@
+//
+// Records, replays and inspects input movies (see Movie.h).
+// Usage: gbmovie record <rom> <script> <movie> [--frames=<n>] [--boot] [--state=<file>] [--dispatch=<core>]
+//          records the input of a script: one "<frame> <buttons>" line per change, buttons joined with '+'
+//          out of right left up down a b select start, or "-" for none, e.g. "120 start" and "126 -".
+//          The movie starts at power on, or at the save state given with --state, and lasts until the
+//          last change plus a frame, or --frames.
+//        gbmovie play <rom> <movie> [--dispatch=<core>]
+//          replays a movie headless at full speed and compares the screen at its end with the recorded one
+//        gbmovie info <movie>
+//
+// Exits with 1 on a replay that doesn't match, or anything that can't be read.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Bus.h"
+#include "Movie.h"
+
+namespace {
+
+const char* const BUTTON_NAMES[8] = {"right", "left", "up", "down", "a", "b", "select", "start"};
+
+struct CHANGE {
+    uint64_t frame;
+    uint8_t buttons;
+};
+
+bool parseButtons(const std::string& text, uint8_t& buttons) {
+    buttons = 0;
+    if (text == "-") return true;
+    std::stringstream names(text);
+    std::string name;
+    while (std::getline(names, name, '+')) {
+        int bit = -1;
+        for (int i = 0; i < 8; i++) {
+            if (name == BUTTON_NAMES[i]) bit = i;
+        }
+        if (bit < 0) return false;
+        buttons |= (uint8_t) (1u << bit);
+    }
+    return true;
+}
+
+std::string buttonNames(uint8_t buttons) {
+    std::string out;
+    for (int i = 0; i < 8; i++) {
+        if (!(buttons & (1u << i))) continue;
+        if (!out.empty()) out += '+';
+        out += BUTTON_NAMES[i];
+    }
+    return out.empty() ? "-" : out;
+}
+
+bool readScript(const std::string& path, std::vector<CHANGE>& changes) {
+    std::ifstream script(path);
+    if (!script) {
+        std::cerr << "Can't read the script " << path << "." << std::endl;
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(script, line); number++) {
+        std::stringstream fields(line);
+        std::string buttons;
+        CHANGE change;
+        if (line.empty() || line[0] == '#') continue;
+        if (!(fields >> change.frame >> buttons) || !parseButtons(buttons, change.buttons)) {
+            std::cerr << path << ":" << number << ": expected \"<frame> <buttons>\"." << std::endl;
+            return false;
+        }
+        changes.push_back(change);
+    }
+    std::stable_sort(changes.begin(), changes.end(),
+                     [](const CHANGE& a, const CHANGE& b) { return a.frame < b.frame; });
+    return true;
+}
+
+std::unique_ptr<Bus> newBus(const std::string& rom, bool skipBoot, CPU::DISPATCH_MODE mode) {
+    std::unique_ptr<Bus> bus(new Bus());
+    bus->verbose = false;
+    bus->serialEcho = false;
+    bus->batterySave = false;
+    bus->cpu.dispatchMode = mode;
+    bus->init(rom, skipBoot);
+    if (!bus->cartridge.loaded()) {
+        std::cerr << "Can't load the ROM " << rom << "." << std::endl;
+        bus.reset();
+    }
+    return bus;
+}
+
+int record(const std::string& rom, const std::string& scriptPath, const std::string& path, uint64_t frames,
+           bool skipBoot, const std::string& statePath, CPU::DISPATCH_MODE mode) {
+    std::vector<CHANGE> changes;
+    if (!readScript(scriptPath, changes)) return 1;
+    std::unique_ptr<Bus> bus = newBus(rom, skipBoot, mode);
+    if (!bus) return 1;
+    if (!statePath.empty() && !bus->loadStateFile(statePath)) {
+        std::cerr << "Can't load the save state " << statePath << " for this ROM." << std::endl;
+        return 1;
+    }
+    // frame 0's buttons are held from the anchor on, so they go in before recording starts
+    size_t next = 0;
+    uint8_t initial = 0;
+    for (; next < changes.size() && changes[next].frame == 0; next++) initial = changes[next].buttons;
+    bus->setButtons(initial);
+
+    Movie movie;
+    MovieSession session;
+    session.record(*bus, movie, skipBoot);
+    for (; next < changes.size(); next++) {
+        // a press lands at the start of the frame after the current one
+        if (!session.runToFrame(changes[next].frame - 1)) break;
+        session.press(changes[next].buttons);
+    }
+    uint64_t end = std::max<uint64_t>({1, frames, changes.empty() ? 0 : changes.back().frame + 1});
+    session.runToFrame(end - 1);
+    session.finish();
+    if (!movie.save(path)) {
+        std::cerr << "Can't write the movie " << path << "." << std::endl;
+        return 1;
+    }
+    printf("%s: %llu frames, %zu input changes, screen %016llx\n", path.c_str(), (unsigned long long) movie.frames(),
+           movie.runs.size() - 1, (unsigned long long) movie.endHash);
+    return 0;
+}
+
+int play(const std::string& rom, const std::string& path, CPU::DISPATCH_MODE mode) {
+    Movie movie;
+    if (!movie.load(path)) {
+        std::cerr << "Can't read the movie " << path << "." << std::endl;
+        return 1;
+    }
+    std::unique_ptr<Bus> bus = newBus(rom, movie.skipBoot, mode);
+    if (!bus) return 1;
+    MovieSession session;
+    if (!session.play(*bus, movie)) {
+        std::cerr << "The movie wasn't recorded with " << rom << "." << std::endl;
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    bool complete = session.runToEnd();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t screen = Movie::hashScreen(*bus);
+    bool matches = complete && (movie.endHash == 0 || screen == movie.endHash);
+    printf("%s: %llu frames in %.2f s, screen %016llx, %s\n", path.c_str(), (unsigned long long) movie.frames(),
+           seconds, (unsigned long long) screen,
+           !complete ? "halted before the end" : movie.endHash == 0 ? "nothing recorded to compare"
+                                                                    : matches ? "matches" : "DIFFERS");
+    return matches ? 0 : 1;
+}
+
+int info(const std::string& path) {
+    Movie movie;
+    if (!movie.load(path)) {
+        std::cerr << "Can't read the movie " << path << "." << std::endl;
+        return 1;
+    }
+    printf("anchor: %s\n", movie.anchor == Movie::ANCHOR_STATE ? "save state"
+                           : movie.skipBoot ? "power on (boot ROM skipped)" : "power on");
+    printf("ROM hash: %016llx\n", (unsigned long long) movie.romHash);
+    printf("frames: %llu\n", (unsigned long long) movie.frames());
+    printf("screen at the end: %016llx\n", (unsigned long long) movie.endHash);
+    uint64_t frame = 0;
+    for (const Movie::RUN& r : movie.runs) {
+        printf("%10llu %s\n", (unsigned long long) frame, buttonNames(r.buttons).c_str());
+        frame += r.frames;
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<std::string> positional;
+    uint64_t frames = 0;
+    bool skipBoot = true;
+    std::string statePath;
+    CPU::DISPATCH_MODE mode = CPU::DISPATCH_TABLE;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 9, "--frames=") == 0) {
+            frames = std::stoull(arg.substr(9));
+        } else if (arg == "--boot") {
+            skipBoot = false;
+        } else if (arg.compare(0, 8, "--state=") == 0) {
+            statePath = arg.substr(8);
+        } else if (arg.compare(0, 11, "--dispatch=") == 0) {
+            if (!CPU::parseDispatch(arg.substr(11), mode)) {
+                std::cerr << "Unknown or disabled core " << arg.substr(11) << std::endl;
+                return 1;
+            }
+        } else if (arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+
+    std::string command = positional.empty() ? "" : positional[0];
+    if (command == "record" && positional.size() == 4) {
+        return record(positional[1], positional[2], positional[3], frames, skipBoot, statePath, mode);
+    }
+    if (command == "play" && positional.size() == 3) return play(positional[1], positional[2], mode);
+    if (command == "info" && positional.size() == 2) return info(positional[1]);
+    std::cerr << "Usage: " << argv[0] << " record <rom> <script> <movie> [--frames=<n>] [--boot] [--state=<file>]"
+              << " [--dispatch=<core>]\n"
+              << "       " << argv[0] << " play <rom> <movie> [--dispatch=<core>]\n"
+              << "       " << argv[0] << " info <movie>" << std::endl;
+    return 1;
+}
@@ -0,0 +1,231 @@
+//
+// Batch runner: many independent emulator instances across a thread pool, one result line each.
+// Usage: gbrunner [options] <rom>...
+//   --list=<file>        read more ROM paths from a file, one per line
+//   --seeds=<n>          run every ROM n times, seeding the power-on WRAM/HRAM contents with 0..n-1
+//                        (seed 0 = cleared memory, as a plain run)
+//   --cycles=<n>         budget per run in clock cycles (T-cycles) of emulated time
+//   --frames=<n>         budget per run in frames (70224 clock cycles each, LCD on or not); default 600
+//   --threads=<n>        worker threads, default one per hardware thread
+//   --dispatch=<core>    switch|table|threaded|block|jit, default table
+//   --boot               run the boot ROM first (DMG_ROM_2_2.bin) instead of starting at 0x0100
+//   --movie=<file>       replay an input movie (see gbmovie) in every run, from its anchor to its end;
+//                        the movie decides the budget and whether the boot ROM runs
+//
+// Output, in input order, tab separated:
+//   rom seed status cycles frames ms AF BC DE HL SP PC framebuffer-hash "serial output"
+// status: budget (ran the whole budget), halted (HALT/STOP nothing can wake), error (ROM not loaded, or
+// not the one the movie was recorded with), or with a movie match/differs (the screen at its end).
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Bus.h"
+#include "Movie.h"
+#include "ThreadPool.h"
+
+namespace {
+
+const uint64_t FRAME_CLOCKS = 70224;
+// M-cycles per runChunk call: bounds the overshoot past the budget, not the speed
+const int RUN_SLICE = 1 << 16;
+
+struct JOB {
+    std::string rom;
+    uint64_t seed;
+};
+
+struct RESULT {
+    const char* status = "error";
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+    double ms = 0;
+    CPU::REGS regs{};
+    uint64_t framebufferHash = 0;
+    std::string serial;
+};
+
+// splitmix64: a seed gives the same memory on every host
+uint64_t nextRandom(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27u)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31u);
+}
+
+// Real hardware powers on with noise in its RAM; ROMs that read it before writing it show it
+void seedMemory(Bus& bus, uint64_t seed) {
+    if (seed == 0) return;
+    uint64_t state = seed;
+    for (uint32_t addr = 0xC000; addr < 0xE000; addr += 8) {
+        uint64_t bits = nextRandom(state);
+        for (uint32_t i = 0; i < 8; i++) bus.RAM[addr + i] = (uint8_t) (bits >> (8 * i));
+    }
+    for (uint32_t addr = 0xFF80; addr < 0xFFFF; addr++) bus.RAM[addr] = (uint8_t) nextRandom(state);
+}
+
+uint64_t fnv1a(const uint8_t* data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+void runJob(const JOB& job, uint64_t budget, CPU::DISPATCH_MODE mode, bool skipBoot, const Movie* movie,
+            RESULT& result) {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<Bus> bus(new Bus());
+    // every instance keeps to itself: no console output, no shared save file
+    bus->verbose = false;
+    bus->serialEcho = false;
+    bus->batterySave = false;
+    bus->serialCapture = &result.serial;
+    bus->cpu.dispatchMode = mode;
+    bus->init(job.rom, skipBoot);
+    if (!bus->cartridge.loaded()) return;
+    seedMemory(*bus, job.seed);
+
+    uint64_t end = bus->clock + budget;
+    // the movie's input changes are scheduled events, the run loop stays the same
+    MovieSession session;
+    if (movie) {
+        if (!session.play(*bus, *movie)) return;
+        end = session.endClock();
+    }
+    result.status = "budget";
+    while (bus->clock < end) {
+        if (bus->haltedForever()) {
+            result.status = "halted";
+            break;
+        }
+        bus->runChunk((int) std::min<uint64_t>((end - bus->clock + 3) / 4, RUN_SLICE));
+    }
+    result.cycles = bus->clock;
+    // the PPU draws lazily: bring the frame buffer up to the end of the run
+    bus->ppu.catchUp(bus->clock);
+    result.frames = bus->ppu.frames();
+    result.framebufferHash = fnv1a(bus->ppu.framebuffer(), PPU::WIDTH * PPU::HEIGHT);
+    result.regs = bus->cpu.state().regs;
+    if (movie && movie->endHash && result.status[0] == 'b') {
+        result.status = result.framebufferHash == movie->endHash ? "match" : "differs";
+    }
+    result.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string quoted(const std::string& text) {
+    std::string out = "\"";
+    for (unsigned char c : text) {
+        char buffer[8];
+        if (c == '\n') out += "\\n";
+        else if (c == '"' || c == '\\') (out += '\\') += (char) c;
+        else if (c >= 0x20 && c < 0x7F) out += (char) c;
+        else {
+            snprintf(buffer, sizeof buffer, "\\x%02x", c);
+            out += buffer;
+        }
+    }
+    return out + "\"";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<std::string> roms;
+    uint64_t seeds = 1;
+    uint64_t budget = 600 * FRAME_CLOCKS;
+    unsigned threads = 0;
+    CPU::DISPATCH_MODE mode = CPU::DISPATCH_TABLE;
+    bool skipBoot = true;
+    std::unique_ptr<Movie> movie;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 7, "--list=") == 0) {
+            std::ifstream list(arg.substr(7));
+            if (!list) {
+                std::cerr << "Could not read ROM list " << arg.substr(7) << std::endl;
+                return 1;
+            }
+            std::string line;
+            while (std::getline(list, line)) {
+                if (!line.empty() && line[0] != '#') roms.push_back(line);
+            }
+        } else if (arg.compare(0, 8, "--seeds=") == 0) {
+            seeds = std::max<uint64_t>(1, std::stoull(arg.substr(8)));
+        } else if (arg.compare(0, 9, "--cycles=") == 0) {
+            budget = std::stoull(arg.substr(9));
+        } else if (arg.compare(0, 9, "--frames=") == 0) {
+            budget = std::stoull(arg.substr(9)) * FRAME_CLOCKS;
+        } else if (arg.compare(0, 10, "--threads=") == 0) {
+            threads = (unsigned) std::stoul(arg.substr(10));
+        } else if (arg.compare(0, 11, "--dispatch=") == 0) {
+            if (!CPU::parseDispatch(arg.substr(11), mode)) {
+                std::cerr << "Unknown or disabled core " << arg.substr(11) << std::endl;
+                return 1;
+            }
+        } else if (arg == "--boot") {
+            skipBoot = false;
+        } else if (arg.compare(0, 8, "--movie=") == 0) {
+            movie.reset(new Movie());
+            if (!movie->load(arg.substr(8))) {
+                std::cerr << "Could not read movie " << arg.substr(8) << std::endl;
+                return 1;
+            }
+        } else if (arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        } else {
+            roms.push_back(arg);
+        }
+    }
+    if (roms.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--list=<file>] [--seeds=<n>] [--cycles=<n>|--frames=<n>] [--threads=<n>]"
+                  << " [--dispatch=switch|table|threaded|block|jit] [--boot] [--movie=<file>] <rom>..."
+                  << std::endl;
+        return 1;
+    }
+    if (movie) skipBoot = movie->skipBoot;
+
+    std::vector<JOB> jobs;
+    for (const std::string& rom : roms) {
+        for (uint64_t seed = 0; seed < seeds; seed++) jobs.push_back(JOB{rom, seed});
+    }
+    // every job writes its own slot, so the results need no locking
+    std::vector<RESULT> results(jobs.size());
+
+    auto start = std::chrono::steady_clock::now();
+    ThreadPool pool(threads);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        pool.submit([&, i] { runJob(jobs[i], budget, mode, skipBoot, movie.get(), results[i]); });
+    }
+    pool.wait();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t errors = 0;
+    size_t differs = 0;
+    uint64_t cycles = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const RESULT& r = results[i];
+        if (r.status[0] == 'e') errors++;
+        if (r.status[0] == 'd') differs++;
+        cycles += r.cycles;
+        printf("%s\t%llu\t%s\t%llu\t%llu\t%.1f\t%04x\t%04x\t%04x\t%04x\t%04x\t%04x\t%016llx\t%s\n",
+               jobs[i].rom.c_str(), (unsigned long long) jobs[i].seed, r.status, (unsigned long long) r.cycles,
+               (unsigned long long) r.frames, r.ms, r.regs.af.AF, r.regs.bc.BC, r.regs.de.DE, r.regs.hl.HL,
+               r.regs.sp, r.regs.pc, (unsigned long long) r.framebufferHash, quoted(r.serial).c_str());
+    }
+    fprintf(stderr, "%zu runs on %u threads in %.2f s (%.1fx real time), %zu errors", jobs.size(), pool.size(),
+            seconds, cycles / 4194304.0 / seconds, errors);
+    if (movie) fprintf(stderr, ", %zu replays differ", differs);
+    fprintf(stderr, "\n");
+    return errors || differs ? 1 : 0;
+}
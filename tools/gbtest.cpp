@@ -0,0 +1,188 @@
+//
+// Conformance harness: runs test ROMs headless and reports pass/fail with timing for each.
+// Usage: gbtest [options] <rom>...
+//   --list=<file>        read more ROM paths from a file, one per line
+//   --cycles=<n>         budget per ROM in clock cycles (T-cycles) of emulated time; default 120 s worth
+//   --threads=<n>        ROMs run at once, default 1 (more skews the wall times and MIPS)
+//   --dispatch=<core>    switch|table|threaded|block|jit, default table
+//   --boot               run the boot ROM first (DMG_ROM_2_2.bin) instead of starting at 0x0100
+//
+// A ROM passes or fails by
+//   serial output:  "Passed" / "Failed" (Blargg's suites print their results through the link port)
+//   registers:      B C D E H L = 3 5 8 13 21 34 / all 0x42 (Mooneye's suite, set before its LD B,B)
+// and is cut off as a TIMEOUT when the budget runs out first, or as HALTED when it stops for good.
+// Exits with 1 unless every ROM passed.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Bus.h"
+#include "ThreadPool.h"
+
+namespace {
+
+const uint64_t CLOCKS_PER_SECOND = 4194304;
+// M-cycles per runChunk call: how often the registers are checked at the least
+const int RUN_SLICE = 1 << 14;
+
+enum OUTCOME { PASS, FAIL, TIMEOUT, HALTED, LOAD_ERROR };
+const char* const OUTCOME_NAMES[] = {"PASS", "FAIL", "TIMEOUT", "HALTED", "ERROR"};
+
+struct RESULT {
+    OUTCOME outcome = LOAD_ERROR;
+    const char* detectedBy = "-";
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    double seconds = 0;
+    std::string serial;
+};
+
+// Mooneye's pass/fail register signature, or TIMEOUT for neither
+OUTCOME registerSignature(const CPU::REGS& regs) {
+    if (regs.bc.B == 3 && regs.bc.C == 5 && regs.de.D == 8 && regs.de.E == 13 && regs.hl.H == 21 && regs.hl.L == 34) {
+        return PASS;
+    }
+    if (regs.bc.BC == 0x4242 && regs.de.DE == 0x4242 && regs.hl.HL == 0x4242) return FAIL;
+    return TIMEOUT;
+}
+
+void runTest(const std::string& rom, uint64_t budget, CPU::DISPATCH_MODE mode, bool skipBoot, RESULT& result) {
+    std::unique_ptr<Bus> bus(new Bus());
+    bus->verbose = false;
+    bus->serialEcho = false;
+    bus->batterySave = false;
+    bus->serialCapture = &result.serial;
+    bus->cpu.dispatchMode = mode;
+    bus->init(rom, skipBoot);
+    if (!bus->cartridge.loaded()) return;
+
+    result.outcome = TIMEOUT;
+    size_t scanned = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (bus->clock < budget) {
+        if (bus->haltedForever()) {
+            result.outcome = HALTED;
+            break;
+        }
+        bus->runChunk((int) std::min<uint64_t>((budget - bus->clock + 3) / 4, RUN_SLICE));
+        if (result.serial.size() != scanned) {
+            // only the new text (and enough before it for a word split over two transfers)
+            size_t from = scanned > 6 ? scanned - 6 : 0;
+            scanned = result.serial.size();
+            size_t found = result.serial.find("Passed", from);
+            result.outcome = found != std::string::npos ? PASS : TIMEOUT;
+            if (found == std::string::npos) {
+                found = result.serial.find("Failed", from);
+                if (found != std::string::npos) result.outcome = FAIL;
+            }
+            if (result.outcome != TIMEOUT) {
+                result.detectedBy = "serial";
+                // let the ROM finish the line ("Failed #3", "Passed all tests"), for at most a second
+                uint64_t end = std::min(budget, bus->clock + CLOCKS_PER_SECOND);
+                while (result.serial.find('\n', found) == std::string::npos && bus->clock < end &&
+                       !bus->haltedForever()) {
+                    bus->runChunk((int) std::min<uint64_t>((end - bus->clock + 3) / 4, RUN_SLICE));
+                }
+                break;
+            }
+        }
+        result.outcome = registerSignature(bus->cpu.regs);
+        if (result.outcome != TIMEOUT) {
+            result.detectedBy = "registers";
+            break;
+        }
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.cycles = bus->clock;
+    result.instructions = bus->cpu.instructions();
+}
+
+// Last non-empty line of the serial output, for the report
+std::string lastLine(const std::string& text) {
+    size_t end = text.find_last_not_of("\n\r ");
+    if (end == std::string::npos) return "";
+    size_t start = text.find_last_of('\n', end);
+    return text.substr(start == std::string::npos ? 0 : start + 1, end + 1 - (start == std::string::npos ? 0 : start + 1));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<std::string> roms;
+    uint64_t budget = 120 * CLOCKS_PER_SECOND;
+    unsigned threads = 1;
+    CPU::DISPATCH_MODE mode = CPU::DISPATCH_TABLE;
+    bool skipBoot = true;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 7, "--list=") == 0) {
+            std::ifstream list(arg.substr(7));
+            if (!list) {
+                std::cerr << "Could not read ROM list " << arg.substr(7) << std::endl;
+                return 1;
+            }
+            std::string line;
+            while (std::getline(list, line)) {
+                if (!line.empty() && line[0] != '#') roms.push_back(line);
+            }
+        } else if (arg.compare(0, 9, "--cycles=") == 0) {
+            budget = std::stoull(arg.substr(9));
+        } else if (arg.compare(0, 10, "--threads=") == 0) {
+            threads = (unsigned) std::stoul(arg.substr(10));
+        } else if (arg.compare(0, 11, "--dispatch=") == 0) {
+            if (!CPU::parseDispatch(arg.substr(11), mode)) {
+                std::cerr << "Unknown or disabled core " << arg.substr(11) << std::endl;
+                return 1;
+            }
+        } else if (arg == "--boot") {
+            skipBoot = false;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        } else {
+            roms.push_back(arg);
+        }
+    }
+    if (roms.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--list=<file>] [--cycles=<n>] [--threads=<n>]"
+                  << " [--dispatch=switch|table|threaded|block|jit] [--boot] <rom>..." << std::endl;
+        return 1;
+    }
+
+    std::vector<RESULT> results(roms.size());
+    {
+        ThreadPool pool(threads);
+        for (size_t i = 0; i < roms.size(); i++) {
+            pool.submit([&, i] { runTest(roms[i], budget, mode, skipBoot, results[i]); });
+        }
+    }
+
+    size_t width = 3;
+    for (const std::string& rom : roms) width = std::max(width, rom.size());
+    printf("%-*s  %-7s  %-9s  %13s  %9s  %8s  %s\n", (int) width, "ROM", "RESULT", "BY", "CYCLES", "WALL(ms)", "MIPS",
+           "SERIAL");
+    unsigned counts[5] = {};
+    uint64_t instructions = 0;
+    double seconds = 0;
+    for (size_t i = 0; i < roms.size(); i++) {
+        const RESULT& r = results[i];
+        counts[r.outcome]++;
+        instructions += r.instructions;
+        seconds += r.seconds;
+        double mips = r.seconds > 0 ? r.instructions / r.seconds / 1e6 : 0;
+        printf("%-*s  %-7s  %-9s  %13llu  %9.1f  %8.1f  %s\n", (int) width, roms[i].c_str(), OUTCOME_NAMES[r.outcome],
+               r.detectedBy, (unsigned long long) r.cycles, r.seconds * 1000, mips, lastLine(r.serial).c_str());
+    }
+    printf("\n%u passed, %u failed, %u timed out, %u halted, %u not loaded; %.2f s, %.1f MIPS overall\n",
+           counts[PASS], counts[FAIL], counts[TIMEOUT], counts[HALTED], counts[LOAD_ERROR], seconds,
+           seconds > 0 ? instructions / seconds / 1e6 : 0);
+    return counts[PASS] == roms.size() ? 0 : 1;
+}
@@ -0,0 +1,287 @@
+//
+// Decodes, searches and compares binary execution traces (see Trace.h; NESEmulator --trace-file=<path>).
+// Usage: gbtrace dump <trace> [--from=<n>] [--count=<n>] [--cycles]
+//          one gameboy-doctor line per instruction ("A:01 F:B0 ... PC:0100 PCMEM:00,C3,13,02")
+//        gbtrace grep <trace> <field>=<hex>... [--count=<n>]
+//          the instructions matching every condition, fields: a f b c d e h l sp pc op
+//          (op: the opcode, "cbxx" for a prefixed one)
+//        gbtrace diff <trace> <reference> [--context=<n>] [--no-mem]
+//          the first instruction where the trace and a gameboy-doctor log (or another trace) disagree
+//          (record the trace with NESEmulator --doctor-ly to diff it against a gameboy-doctor log: those
+//          were taken with LY reading 0x90)
+//
+// Exits with 1 on a difference or an unreadable input.
+//
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "DoctorLog.h"
+#include "Trace.h"
+
+namespace {
+
+const char* const REG_NAMES[TRACE_RECORD::REG_COUNT] = {"A", "F", "B", "C", "D", "E", "H", "L"};
+
+void printRecord(uint64_t index, const TRACE_RECORD& r, bool cycles, const char* marker = "") {
+    char line[DoctorLog::LINE_LENGTH];
+    DoctorLog::format(r, line);
+    line[DoctorLog::LINE_LENGTH - 1] = '\0';
+    if (cycles) printf("%s%10llu  %s CY:%u\n", marker, (unsigned long long) index, line, r.cycles);
+    else printf("%s%10llu  %s\n", marker, (unsigned long long) index, line);
+}
+
+bool parseDoctorLine(const std::string& line, TRACE_RECORD& r) {
+    unsigned v[8], sp, pc, mem[4];
+    if (sscanf(line.c_str(), " A:%x F:%x B:%x C:%x D:%x E:%x H:%x L:%x SP:%x PC:%x PCMEM:%x,%x,%x,%x",
+               &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &sp, &pc,
+               &mem[0], &mem[1], &mem[2], &mem[3]) != 14) {
+        return false;
+    }
+    for (int i = 0; i < TRACE_RECORD::REG_COUNT; i++) r.regs[i] = (uint8_t) v[i];
+    r.sp = (uint16_t) sp;
+    r.pc = (uint16_t) pc;
+    for (int i = 0; i < 4; i++) r.mem[i] = (uint8_t) mem[i];
+    r.cycles = 0;
+    return true;
+}
+
+/**
+ * The reference side of a diff: another trace, or a gameboy-doctor log (told apart by the trace magic).
+ */
+class Reference {
+public:
+    bool open(const std::string& path) {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f) return false;
+        char magic[4] = {};
+        bool isTrace = fread(magic, 1, 4, f) == 4 && std::memcmp(magic, TraceCodec::MAGIC, 4) == 0;
+        fclose(f);
+        if (isTrace) {
+            trace = true;
+            return reader.open(path);
+        }
+        log = fopen(path.c_str(), "r");
+        return log != nullptr;
+    }
+    ~Reference() {
+        if (log) fclose(log);
+    }
+
+    bool next(TRACE_RECORD& r) {
+        if (trace) return reader.next(r);
+        char buffer[256];
+        while (fgets(buffer, sizeof buffer, log)) {
+            line++;
+            // anything else in the log (blank lines, emulator chatter) is skipped
+            if (parseDoctorLine(buffer, r)) return true;
+        }
+        return false;
+    }
+    bool hasCycles() const { return trace; }
+    uint64_t where() const { return trace ? reader.index() : line; }
+    const char* unit() const { return trace ? "record" : "line"; }
+
+private:
+    bool trace = false;
+    TraceReader reader;
+    FILE* log = nullptr;
+    uint64_t line = 0;
+};
+
+bool openTrace(TraceReader& reader, const std::string& path) {
+    if (reader.open(path)) return true;
+    std::cerr << "Can't read the trace " << path << "." << std::endl;
+    return false;
+}
+
+int finish(const TraceReader& reader) {
+    if (!reader.error()) return 0;
+    std::cerr << "The trace is corrupt after record " << reader.index() << "." << std::endl;
+    return 1;
+}
+
+int dump(const std::string& path, uint64_t from, uint64_t count, bool cycles) {
+    TraceReader reader;
+    if (!openTrace(reader, path)) return 1;
+    DoctorLog log;
+    if (!cycles) log.openStream(stdout);
+    TRACE_RECORD r;
+    while (count && reader.next(r)) {
+        if (reader.index() < from) continue;
+        if (cycles) printRecord(reader.index(), r, true);
+        else log.write(r);
+        count--;
+    }
+    log.close();
+    return finish(reader);
+}
+
+struct CONDITION {
+    int field; // REG index, or one of the below
+    unsigned value;
+};
+const int FIELD_SP = 100, FIELD_PC = 101, FIELD_OP = 102, FIELD_CB = 103;
+
+bool parseCondition(const std::string& arg, CONDITION& c) {
+    size_t eq = arg.find('=');
+    if (eq == std::string::npos) return false;
+    std::string name = arg.substr(0, eq);
+    std::string value = arg.substr(eq + 1);
+    c.field = -1;
+    for (int i = 0; i < TRACE_RECORD::REG_COUNT; i++) {
+        if (name.size() == 1 && (char) tolower(REG_NAMES[i][0]) == tolower(name[0])) c.field = i;
+    }
+    if (name == "sp") c.field = FIELD_SP;
+    if (name == "pc") c.field = FIELD_PC;
+    if (name == "op") {
+        c.field = FIELD_OP;
+        if (value.size() == 4 && (value.compare(0, 2, "cb") == 0 || value.compare(0, 2, "CB") == 0)) {
+            c.field = FIELD_CB;
+            value = value.substr(2);
+        }
+    }
+    if (c.field < 0 || value.empty()) return false;
+    char* end;
+    c.value = (unsigned) strtoul(value.c_str(), &end, 16);
+    return *end == '\0';
+}
+
+bool matches(const TRACE_RECORD& r, const std::vector<CONDITION>& conditions) {
+    for (const CONDITION& c : conditions) {
+        unsigned actual;
+        switch (c.field) {
+            case FIELD_SP: actual = r.sp; break;
+            case FIELD_PC: actual = r.pc; break;
+            case FIELD_OP: actual = r.mem[0]; break;
+            case FIELD_CB:
+                if (r.mem[0] != 0xCBu) return false;
+                actual = r.mem[1];
+                break;
+            default: actual = r.regs[c.field]; break;
+        }
+        if (actual != c.value) return false;
+    }
+    return true;
+}
+
+int grep(const std::string& path, const std::vector<CONDITION>& conditions, uint64_t count) {
+    TraceReader reader;
+    if (!openTrace(reader, path)) return 1;
+    TRACE_RECORD r;
+    uint64_t found = 0;
+    while (found < count && reader.next(r)) {
+        if (!matches(r, conditions)) continue;
+        printRecord(reader.index(), r, true);
+        found++;
+    }
+    if (finish(reader)) return 1;
+    printf("%llu matches\n", (unsigned long long) found);
+    return 0;
+}
+
+int diff(const std::string& path, const std::string& referencePath, size_t context, bool compareMem) {
+    TraceReader reader;
+    if (!openTrace(reader, path)) return 1;
+    Reference reference;
+    if (!reference.open(referencePath)) {
+        std::cerr << "Can't read " << referencePath << "." << std::endl;
+        return 1;
+    }
+    // the last few records both sides agreed on
+    std::deque<TRACE_RECORD> history;
+    uint64_t same = 0;
+    TRACE_RECORD t, r;
+    for (;;) {
+        bool hasTest = reader.next(t);
+        bool hasReference = reference.next(r);
+        if (!hasTest || !hasReference) {
+            if (finish(reader)) return 1;
+            if (hasTest == hasReference) {
+                printf("identical, %llu instructions\n", (unsigned long long) same);
+                return 0;
+            }
+            printf("%s ends first, after %llu instructions\n", hasTest ? "the reference" : "the trace",
+                   (unsigned long long) same);
+            return 1;
+        }
+        std::string differs;
+        for (int i = 0; i < TRACE_RECORD::REG_COUNT; i++) {
+            if (t.regs[i] != r.regs[i]) differs += std::string(" ") + REG_NAMES[i];
+        }
+        if (t.sp != r.sp) differs += " SP";
+        if (t.pc != r.pc) differs += " PC";
+        if (compareMem && std::memcmp(t.mem, r.mem, sizeof t.mem) != 0) differs += " PCMEM";
+        if (reference.hasCycles() && t.cycles != r.cycles) differs += " cycles";
+        if (differs.empty()) {
+            same++;
+            history.push_back(t);
+            if (history.size() > context) history.pop_front();
+            continue;
+        }
+
+        uint64_t index = same;
+        printf("first difference at instruction %llu (reference %s %llu):%s\n", (unsigned long long) index,
+               reference.unit(), (unsigned long long) reference.where(), differs.c_str());
+        for (size_t i = 0; i < history.size(); i++) {
+            printRecord(index - history.size() + i, history[i], reference.hasCycles(), "  ");
+        }
+        printRecord(index, r, reference.hasCycles(), "- ");
+        printRecord(index, t, reference.hasCycles(), "+ ");
+        return 1;
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " dump <trace> [--from=<n>] [--count=<n>] [--cycles]\n"
+                  << "       " << argv[0] << " grep <trace> <field>=<hex>... [--count=<n>]   (fields: a f b c d e h l sp pc op)\n"
+                  << "       " << argv[0] << " diff <trace> <doctor-log|trace> [--context=<n>] [--no-mem]" << std::endl;
+        return 1;
+    }
+    std::string command = argv[1];
+    std::string path = argv[2];
+    std::vector<std::string> positional;
+    std::vector<CONDITION> conditions;
+    uint64_t from = 0;
+    uint64_t count = UINT64_MAX;
+    size_t context = 8;
+    bool cycles = false;
+    bool compareMem = true;
+    for (int i = 3; i < argc; i++) {
+        std::string arg(argv[i]);
+        CONDITION condition;
+        if (arg.compare(0, 7, "--from=") == 0) {
+            from = std::stoull(arg.substr(7));
+        } else if (arg.compare(0, 8, "--count=") == 0) {
+            count = std::stoull(arg.substr(8));
+        } else if (arg.compare(0, 10, "--context=") == 0) {
+            context = (size_t) std::stoul(arg.substr(10));
+        } else if (arg == "--cycles") {
+            cycles = true;
+        } else if (arg == "--no-mem") {
+            compareMem = false;
+        } else if (command == "grep" && parseCondition(arg, condition)) {
+            conditions.push_back(condition);
+        } else if (arg.compare(0, 2, "--") != 0) {
+            positional.push_back(arg);
+        } else {
+            std::cerr << "Unknown option " << arg << "." << std::endl;
+            return 1;
+        }
+    }
+
+    if (command == "dump") return dump(path, from, count, cycles);
+    if (command == "grep") return grep(path, conditions, count);
+    if (command == "diff" && positional.size() == 1) return diff(path, positional[0], context, compareMem);
+    std::cerr << "Unknown command or missing arguments, run " << argv[0] << " without any for the usage." << std::endl;
+    return 1;
+}